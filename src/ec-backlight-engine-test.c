@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit test of ec-backlight-engine against fake firmware: write elision,
+ * coalescing on the worker, and how read-backs and failed writes invalidate
+ * the shadow level.
+ */
+
+#include <kunit/test.h>
+#include <linux/completion.h>
+#include <linux/device.h>
+#include <linux/module.h>
+
+#include "ec-backlight-engine.h"
+
+/**
+ * struct fake_fw - fake firmware behind the engine
+ * @level:   level it holds
+ * @sets:    number of set calls
+ * @fails:   number of the next set calls to fail
+ * @block:   have the next set call wait for @release, after completing
+ *           @entered
+ * @entered: completed once a blocked set call has started
+ * @release: lets a blocked set call finish
+ */
+struct fake_fw {
+	u32 level;
+	unsigned int sets;
+	unsigned int fails;
+	bool block;
+	struct completion entered;
+	struct completion release;
+};
+
+/**
+ * struct engine_test - state of one test
+ * @dev:    device owning the engine
+ * @fw:     the fake firmware
+ * @engine: the engine under test
+ */
+struct engine_test {
+	struct device *dev;
+	struct fake_fw fw;
+	struct ec_backlight_engine *engine;
+};
+
+static int fake_get(void *data, u32 *level)
+{
+	struct fake_fw *fw = data;
+
+	*level = fw->level;
+	return 0;
+}
+
+static int fake_set(void *data, u32 level)
+{
+	struct fake_fw *fw = data;
+
+	fw->sets++;
+	if (fw->block) {
+		fw->block = false;
+		complete(&fw->entered);
+		wait_for_completion(&fw->release);
+	}
+	if (fw->fails) {
+		fw->fails--;
+		return -EIO;
+	}
+
+	fw->level = level;
+	return 0;
+}
+
+static const struct ec_backlight_engine_ops fake_ops = {
+	.get = fake_get,
+	.set = fake_set,
+};
+
+static int engine_test_init(struct kunit *test)
+{
+	struct engine_test *t;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t);
+	init_completion(&t->fw.entered);
+	init_completion(&t->fw.release);
+	test->priv = t;
+
+	t->dev = root_device_register("ec-backlight-engine-test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->dev);
+
+	t->engine = ec_backlight_engine_create(t->dev, &fake_ops,
+					       EC_BACKLIGHT_ENGINE_CAP_GET |
+					       EC_BACKLIGHT_ENGINE_CAP_COALESCE,
+					       &t->fw);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->engine);
+
+	return 0;
+}
+
+static void engine_test_exit(struct kunit *test)
+{
+	struct engine_test *t = test->priv;
+
+	if (!t)
+		return;
+
+	/* Releases the engine, stopping its worker, so unblock it first. */
+	complete_all(&t->fw.release);
+	if (!IS_ERR_OR_NULL(t->dev))
+		root_device_unregister(t->dev);
+}
+
+/* Start the worker, with its first set call blocked until released. */
+static void engine_test_block_worker(struct kunit *test, u32 level)
+{
+	struct engine_test *t = test->priv;
+
+	KUNIT_ASSERT_EQ(test, ec_backlight_engine_start_worker(t->engine,
+							      "ec-bl-test"), 0);
+	t->fw.block = true;
+	KUNIT_ASSERT_EQ(test, ec_backlight_engine_set(t->engine, level, 0), 0);
+	wait_for_completion(&t->fw.entered);
+}
+
+static void engine_test_elide(struct kunit *test)
+{
+	struct engine_test *t = test->priv;
+
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 5, 0), 0);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 5, 0), 0);
+	KUNIT_EXPECT_EQ(test, t->fw.sets, 1U);
+
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 5,
+				EC_BACKLIGHT_ENGINE_SET_FORCE), 0);
+	KUNIT_EXPECT_EQ(test, t->fw.sets, 2U);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), 5);
+}
+
+/* A failed synchronous write is reported, and not elided when retried. */
+static void engine_test_sync_failure(struct kunit *test)
+{
+	struct engine_test *t = test->priv;
+
+	t->fw.fails = 1;
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 7, 0), -EIO);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), -1);
+
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 7, 0), 0);
+	KUNIT_EXPECT_EQ(test, t->fw.sets, 2U);
+	KUNIT_EXPECT_EQ(test, t->fw.level, 7U);
+}
+
+/* Only the first and the latest of the writes queued meanwhile go through. */
+static void engine_test_coalesce(struct kunit *test)
+{
+	struct engine_test *t = test->priv;
+	u32 level;
+
+	engine_test_block_worker(test, 1);
+	for (level = 2; level <= 10; level++)
+		KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, level, 0), 0);
+	KUNIT_EXPECT_TRUE(test, ec_backlight_engine_set_pending(t->engine));
+
+	complete(&t->fw.release);
+	ec_backlight_engine_flush(t->engine);
+
+	KUNIT_EXPECT_EQ(test, t->fw.sets, 2U);
+	KUNIT_EXPECT_EQ(test, t->fw.level, 10U);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), 10);
+}
+
+/*
+ * A queued write which fails forgets the shadow level, so that writing the
+ * same level again is not elided.
+ */
+static void engine_test_async_failure(struct kunit *test)
+{
+	struct engine_test *t = test->priv;
+
+	KUNIT_ASSERT_EQ(test, ec_backlight_engine_start_worker(t->engine,
+							      "ec-bl-test"), 0);
+	t->fw.fails = 1;
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 7, 0), 0);
+	ec_backlight_engine_flush(t->engine);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), -1);
+
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 7, 0), 0);
+	ec_backlight_engine_flush(t->engine);
+	KUNIT_EXPECT_EQ(test, t->fw.sets, 2U);
+	KUNIT_EXPECT_EQ(test, t->fw.level, 7U);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), 7);
+}
+
+/* A failed write leaves the shadow level to a newer queued one. */
+static void engine_test_async_failure_superseded(struct kunit *test)
+{
+	struct engine_test *t = test->priv;
+
+	t->fw.fails = 1;
+	engine_test_block_worker(test, 3);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 8, 0), 0);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), 8);
+
+	/* The write of 3 fails once 8 is queued, the write of 8 succeeds. */
+	complete(&t->fw.release);
+	ec_backlight_engine_flush(t->engine);
+
+	KUNIT_EXPECT_EQ(test, t->fw.level, 8U);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), 8);
+}
+
+/* A level read back which differs invalidates the shadow level. */
+static void engine_test_get_refresh(struct kunit *test)
+{
+	struct engine_test *t = test->priv;
+	u32 level;
+
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 5, 0), 0);
+
+	/* The firmware changes the level on its own. */
+	t->fw.level = 9;
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_get(t->engine, &level), 0);
+	KUNIT_EXPECT_EQ(test, level, 9U);
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_shadow(t->engine), -1);
+
+	KUNIT_EXPECT_EQ(test, ec_backlight_engine_set(t->engine, 5, 0), 0);
+	KUNIT_EXPECT_EQ(test, t->fw.sets, 2U);
+	KUNIT_EXPECT_EQ(test, t->fw.level, 5U);
+}
+
+static struct kunit_case ec_backlight_engine_test_cases[] = {
+	KUNIT_CASE(engine_test_elide),
+	KUNIT_CASE(engine_test_sync_failure),
+	KUNIT_CASE(engine_test_coalesce),
+	KUNIT_CASE(engine_test_async_failure),
+	KUNIT_CASE(engine_test_async_failure_superseded),
+	KUNIT_CASE(engine_test_get_refresh),
+	{ }
+};
+
+static struct kunit_suite ec_backlight_engine_test_suite = {
+	.name = "ec-backlight-engine",
+	.init = engine_test_init,
+	.exit = engine_test_exit,
+	.test_cases = ec_backlight_engine_test_cases,
+};
+kunit_test_suite(ec_backlight_engine_test_suite);
+
+MODULE_DESCRIPTION("KUnit test of the EC backlight engine");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,620 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Asynchronous engine for backlight drivers whose brightness control goes
+ * through slow firmware methods: an optional dedicated worker with tunable
+ * scheduling, coalescing of level writes, a shadow of the level last written
+ * to elide redundant writes, and statistics.
+ *
+ * Callers serialize the engine calls which read or write the level, e.g.
+ * with the ops_lock of their backlight device.
+ */
+
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <uapi/linux/sched/types.h>
+
+#include "ec-backlight-engine.h"
+
+/**
+ * struct ec_backlight_engine - engine state
+ * @ops:          firmware interface
+ * @caps:         EC_BACKLIGHT_ENGINE_CAP_* flags
+ * @data:         passed to @ops
+ * @shadow_level: level most recently sent to the firmware, or -1 if unknown;
+ *                the worker only resets it under @set_lock
+ * @set_ns:       moving average of the time taken by level writes
+ * @worker:       dedicated worker executing firmware calls, if started
+ * @worker_lock:  protects @worker against removal, and the settings below
+ * @policy:       scheduling policy of @worker
+ * @priority:     RT priority, or nice value for %SCHED_NORMAL
+ * @cpus:         CPU affinity of @worker
+ * @set_work:     applies @pending_level on @worker
+ * @set_lock:     protects @pending_level and @pending_ns
+ * @pending_level: level waiting to be written, or -1
+ * @pending_ns:   time at which @pending_level was first queued
+ * @stats:        queue-to-execution delay of @worker, coalesced writes and
+ *                failed level writes; only with CONFIG_EC_BACKLIGHT_ENGINE_STATS
+ */
+struct ec_backlight_engine {
+	const struct ec_backlight_engine_ops *ops;
+	unsigned long caps;
+	void *data;
+	int shadow_level;
+	u64 set_ns;
+	struct kthread_worker *worker;
+	struct mutex worker_lock;
+	int policy;
+	int priority;
+	struct cpumask cpus;
+	struct kthread_work set_work;
+	spinlock_t set_lock;
+	int pending_level;
+	u64 pending_ns;
+#ifdef CONFIG_EC_BACKLIGHT_ENGINE_STATS
+	struct {
+		u64 last_ns;
+		u64 max_ns;
+		u64 total_ns;
+		u64 count;
+		u64 coalesced;
+		u64 failures;
+	} stats;
+#endif
+};
+
+#ifdef CONFIG_EC_BACKLIGHT_ENGINE_STATS
+
+#define engine_stat_inc(engine, stat) ((engine)->stats.stat++)
+
+static void engine_account(struct ec_backlight_engine *engine, u64 queued_ns)
+{
+	u64 delay = ktime_get_ns() - queued_ns;
+
+	engine->stats.last_ns = delay;
+	engine->stats.max_ns = max(engine->stats.max_ns, delay);
+	engine->stats.total_ns += delay;
+	engine->stats.count++;
+}
+
+#else
+
+#define engine_stat_inc(engine, stat) do { } while (0)
+
+static void engine_account(struct ec_backlight_engine *engine, u64 queued_ns) { }
+
+#endif /* CONFIG_EC_BACKLIGHT_ENGINE_STATS */
+
+enum ec_backlight_engine_op {
+	EC_BACKLIGHT_ENGINE_OP_GET,
+	EC_BACKLIGHT_ENGINE_OP_GET_MAX,
+	EC_BACKLIGHT_ENGINE_OP_SET,
+};
+
+/**
+ * struct engine_call - a firmware call executed on the worker
+ * @work:      queued on the worker
+ * @done:      completed once the call has been executed
+ * @engine:    the engine
+ * @op:        the callback to run
+ * @val:       level passed to or returned by the callback
+ * @ret:       return value of the callback
+ * @queued_ns: time at which the call was queued
+ */
+struct engine_call {
+	struct kthread_work work;
+	struct completion done;
+	struct ec_backlight_engine *engine;
+	enum ec_backlight_engine_op op;
+	u32 *val;
+	int ret;
+	u64 queued_ns;
+};
+
+/* Run a callback in the current context. */
+static int engine_call(struct ec_backlight_engine *engine,
+		       enum ec_backlight_engine_op op, u32 *val)
+{
+	u64 start, duration;
+	int ret;
+
+	switch (op) {
+	case EC_BACKLIGHT_ENGINE_OP_GET:
+		return engine->ops->get(engine->data, val);
+	case EC_BACKLIGHT_ENGINE_OP_GET_MAX:
+		return engine->ops->get_max(engine->data, val);
+	case EC_BACKLIGHT_ENGINE_OP_SET:
+		start = ktime_get_ns();
+		ret = engine->ops->set(engine->data, *val);
+		duration = ktime_get_ns() - start;
+		if (!ret)
+			WRITE_ONCE(engine->set_ns, engine->set_ns ?
+				   (engine->set_ns * 7 + duration) / 8 : duration);
+		else
+			engine_stat_inc(engine, failures);
+		return ret;
+	}
+
+	return -EINVAL;
+}
+
+static void engine_call_work(struct kthread_work *work)
+{
+	struct engine_call *call = container_of(work, struct engine_call, work);
+
+	engine_account(call->engine, call->queued_ns);
+	call->ret = engine_call(call->engine, call->op, call->val);
+	complete(&call->done);
+}
+
+static void engine_set_work(struct kthread_work *work)
+{
+	struct ec_backlight_engine *engine =
+		container_of(work, struct ec_backlight_engine, set_work);
+	u64 queued_ns;
+	int pending;
+	u32 level;
+
+	spin_lock(&engine->set_lock);
+	pending = engine->pending_level;
+	queued_ns = engine->pending_ns;
+	engine->pending_level = -1;
+	spin_unlock(&engine->set_lock);
+
+	if (pending < 0)
+		return;
+
+	level = pending;
+	engine_account(engine, queued_ns);
+	if (!engine_call(engine, EC_BACKLIGHT_ENGINE_OP_SET, &level))
+		return;
+
+	/*
+	 * Nobody is waiting for this write to fail, so at least don't let the
+	 * shadow level claim that it went through, which would elide writing
+	 * the same level again. A newer level already queued is left to set
+	 * the shadow level.
+	 */
+	spin_lock(&engine->set_lock);
+	if (engine->pending_level < 0)
+		WRITE_ONCE(engine->shadow_level, -1);
+	spin_unlock(&engine->set_lock);
+}
+
+/* Run a callback on the worker if there is one, and wait for its result. */
+static int engine_run(struct ec_backlight_engine *engine,
+		      enum ec_backlight_engine_op op, u32 *val)
+{
+	struct engine_call call;
+
+	if (!engine->worker)
+		return engine_call(engine, op, val);
+
+	kthread_init_work(&call.work, engine_call_work);
+	init_completion(&call.done);
+	call.engine = engine;
+	call.op = op;
+	call.val = val;
+	call.queued_ns = ktime_get_ns();
+
+	kthread_queue_work(engine->worker, &call.work);
+	wait_for_completion(&call.done);
+
+	return call.ret;
+}
+
+/**
+ * ec_backlight_engine_get() - read the current level
+ * @engine: the engine
+ * @level:  returns the level
+ *
+ * Without %EC_BACKLIGHT_ENGINE_CAP_GET, the shadow level is returned.
+ * Otherwise, a level read back which differs from the shadow level, e.g.
+ * because the firmware changed it on its own, invalidates the shadow level,
+ * so that writing the previous level again is not elided.
+ *
+ * Returns 0 on success, or a negative error number on failure.
+ */
+int ec_backlight_engine_get(struct ec_backlight_engine *engine, u32 *level)
+{
+	int ret;
+
+	if (!(engine->caps & EC_BACKLIGHT_ENGINE_CAP_GET)) {
+		int shadow = READ_ONCE(engine->shadow_level);
+
+		if (shadow < 0)
+			return -ENODATA;
+		*level = shadow;
+		return 0;
+	}
+
+	ret = engine_run(engine, EC_BACKLIGHT_ENGINE_OP_GET, level);
+	if (ret)
+		return ret;
+
+	/*
+	 * Don't adopt the level read back: the caller may want to correct it.
+	 * A level still queued on the worker is about to replace it anyway.
+	 */
+	spin_lock(&engine->set_lock);
+	if (engine->pending_level < 0 &&
+	    READ_ONCE(engine->shadow_level) != (int)*level)
+		WRITE_ONCE(engine->shadow_level, -1);
+	spin_unlock(&engine->set_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_get);
+
+/**
+ * ec_backlight_engine_get_max() - read the maximum level
+ * @engine:    the engine
+ * @max_level: returns the maximum level
+ *
+ * Returns 0 on success, or a negative error number on failure.
+ */
+int ec_backlight_engine_get_max(struct ec_backlight_engine *engine,
+				u32 *max_level)
+{
+	if (!(engine->caps & EC_BACKLIGHT_ENGINE_CAP_GET_MAX))
+		return -EOPNOTSUPP;
+
+	return engine_run(engine, EC_BACKLIGHT_ENGINE_OP_GET_MAX, max_level);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_get_max);
+
+/**
+ * ec_backlight_engine_set() - write a level
+ * @engine: the engine
+ * @level:  the level
+ * @flags:  EC_BACKLIGHT_ENGINE_SET_* flags
+ *
+ * The write is elided if @level is the shadow level, unless forced. With a
+ * worker and %EC_BACKLIGHT_ENGINE_CAP_COALESCE, the write is queued and 0 is
+ * returned right away; only the latest queued level reaches the firmware.
+ * If that write fails, the failure is counted and the shadow level is
+ * forgotten, so that the next write of any level goes through.
+ *
+ * Returns 0 on success, or a negative error number on failure.
+ */
+int ec_backlight_engine_set(struct ec_backlight_engine *engine, u32 level,
+			    unsigned int flags)
+{
+	int ret;
+
+	if (!(flags & EC_BACKLIGHT_ENGINE_SET_FORCE) &&
+	    READ_ONCE(engine->shadow_level) == (int)level)
+		return 0;
+
+	if (!(flags & EC_BACKLIGHT_ENGINE_SET_DIRECT) && engine->worker &&
+	    (engine->caps & EC_BACKLIGHT_ENGINE_CAP_COALESCE)) {
+		spin_lock(&engine->set_lock);
+		WRITE_ONCE(engine->shadow_level, level);
+		if (engine->pending_level < 0)
+			engine->pending_ns = ktime_get_ns();
+		else
+			engine_stat_inc(engine, coalesced);
+		engine->pending_level = level;
+		spin_unlock(&engine->set_lock);
+
+		kthread_queue_work(engine->worker, &engine->set_work);
+		return 0;
+	}
+
+	WRITE_ONCE(engine->shadow_level, level);
+
+	if (flags & EC_BACKLIGHT_ENGINE_SET_DIRECT)
+		ret = engine_call(engine, EC_BACKLIGHT_ENGINE_OP_SET, &level);
+	else
+		ret = engine_run(engine, EC_BACKLIGHT_ENGINE_OP_SET, &level);
+
+	if (ret)
+		WRITE_ONCE(engine->shadow_level, -1);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_set);
+
+/* The level most recently sent to the firmware, or -1 if unknown. */
+int ec_backlight_engine_shadow(struct ec_backlight_engine *engine)
+{
+	return READ_ONCE(engine->shadow_level);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_shadow);
+
+/* Record level as applied by the firmware, e.g. as read back when probing. */
+void ec_backlight_engine_set_shadow(struct ec_backlight_engine *engine,
+				    int level)
+{
+	WRITE_ONCE(engine->shadow_level, level);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_set_shadow);
+
+/* Whether a level write is queued on the worker and not yet started. */
+bool ec_backlight_engine_set_pending(struct ec_backlight_engine *engine)
+{
+	bool pending;
+
+	spin_lock(&engine->set_lock);
+	pending = engine->pending_level >= 0;
+	spin_unlock(&engine->set_lock);
+
+	return pending;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_set_pending);
+
+/* Moving average of the time taken by level writes, in nanoseconds. */
+u64 ec_backlight_engine_set_latency(struct ec_backlight_engine *engine)
+{
+	return READ_ONCE(engine->set_ns);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_set_latency);
+
+static int engine_apply_sched(struct ec_backlight_engine *engine)
+{
+	struct sched_attr attr = {
+		.size = sizeof(attr),
+		.sched_policy = engine->policy,
+	};
+	int ret;
+
+	lockdep_assert_held(&engine->worker_lock);
+
+	if (!engine->worker)
+		return 0;
+
+	if (engine->policy == SCHED_NORMAL)
+		attr.sched_nice = engine->priority;
+	else
+		attr.sched_priority = engine->priority;
+
+	ret = sched_setattr_nocheck(engine->worker->task, &attr);
+	if (ret)
+		return ret;
+
+	return set_cpus_allowed_ptr(engine->worker->task, &engine->cpus);
+}
+
+int ec_backlight_engine_policy(struct ec_backlight_engine *engine)
+{
+	return READ_ONCE(engine->policy);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_policy);
+
+/**
+ * ec_backlight_engine_set_policy() - set the scheduling policy of the worker
+ * @engine: the engine
+ * @policy: %SCHED_NORMAL, %SCHED_FIFO or %SCHED_RR
+ *
+ * Switching between %SCHED_NORMAL and an RT policy resets the priority to
+ * nice 0, or RT priority 1 respectively.
+ *
+ * Returns 0 on success, or a negative error number on failure.
+ */
+int ec_backlight_engine_set_policy(struct ec_backlight_engine *engine,
+				   int policy)
+{
+	int old, old_priority, ret;
+
+	if (policy != SCHED_NORMAL && policy != SCHED_FIFO &&
+	    policy != SCHED_RR)
+		return -EINVAL;
+
+	mutex_lock(&engine->worker_lock);
+	old = engine->policy;
+	old_priority = engine->priority;
+	WRITE_ONCE(engine->policy, policy);
+	if ((old == SCHED_NORMAL) != (policy == SCHED_NORMAL))
+		WRITE_ONCE(engine->priority, policy == SCHED_NORMAL ? 0 : 1);
+	ret = engine_apply_sched(engine);
+	if (ret) {
+		WRITE_ONCE(engine->policy, old);
+		WRITE_ONCE(engine->priority, old_priority);
+	}
+	mutex_unlock(&engine->worker_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_set_policy);
+
+int ec_backlight_engine_priority(struct ec_backlight_engine *engine)
+{
+	return READ_ONCE(engine->priority);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_priority);
+
+/* Set the RT priority, or nice value for %SCHED_NORMAL, of the worker. */
+int ec_backlight_engine_set_priority(struct ec_backlight_engine *engine,
+				     int priority)
+{
+	int old, ret;
+
+	mutex_lock(&engine->worker_lock);
+	old = engine->priority;
+	WRITE_ONCE(engine->priority, priority);
+	ret = engine_apply_sched(engine);
+	if (ret)
+		WRITE_ONCE(engine->priority, old);
+	mutex_unlock(&engine->worker_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_set_priority);
+
+void ec_backlight_engine_cpus(struct ec_backlight_engine *engine,
+			      struct cpumask *cpus)
+{
+	mutex_lock(&engine->worker_lock);
+	cpumask_copy(cpus, &engine->cpus);
+	mutex_unlock(&engine->worker_lock);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_cpus);
+
+/* Set the CPU affinity of the worker. */
+int ec_backlight_engine_set_cpus(struct ec_backlight_engine *engine,
+				 const struct cpumask *cpus)
+{
+	int ret = 0;
+
+	if (cpumask_empty(cpus))
+		return -EINVAL;
+
+	mutex_lock(&engine->worker_lock);
+	if (engine->worker)
+		ret = set_cpus_allowed_ptr(engine->worker->task, cpus);
+	if (!ret)
+		cpumask_copy(&engine->cpus, cpus);
+	mutex_unlock(&engine->worker_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_set_cpus);
+
+/**
+ * ec_backlight_engine_start_worker() - execute firmware calls on a kthread
+ * @engine: the engine
+ * @name:   name of the kthread
+ *
+ * The worker starts out at the lowest RT priority, ahead of any
+ * %SCHED_NORMAL load, on any CPU.
+ *
+ * Returns 0 on success, or a negative error number on failure.
+ */
+int ec_backlight_engine_start_worker(struct ec_backlight_engine *engine,
+				     const char *name)
+{
+	struct kthread_worker *worker;
+	int ret;
+
+	worker = kthread_create_worker(0, "%s", name);
+	if (IS_ERR(worker))
+		return PTR_ERR(worker);
+
+	mutex_lock(&engine->worker_lock);
+	engine->worker = worker;
+	ret = engine_apply_sched(engine);
+	mutex_unlock(&engine->worker_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_start_worker);
+
+/**
+ * ec_backlight_engine_stop_worker() - go back to calling the firmware directly
+ * @engine: the engine
+ *
+ * Drains the worker, including any queued level write, so call this while
+ * whatever the callbacks use is still around. Serialized like the level
+ * reads and writes. Also done when the device which created the engine is
+ * unbound.
+ */
+void ec_backlight_engine_stop_worker(struct ec_backlight_engine *engine)
+{
+	struct kthread_worker *worker;
+
+	mutex_lock(&engine->worker_lock);
+	worker = engine->worker;
+	engine->worker = NULL;
+	mutex_unlock(&engine->worker_lock);
+
+	if (worker)
+		kthread_destroy_worker(worker);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_stop_worker);
+
+bool ec_backlight_engine_has_worker(struct ec_backlight_engine *engine)
+{
+	return READ_ONCE(engine->worker);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_has_worker);
+
+/* Wait for queued firmware calls to complete. */
+void ec_backlight_engine_flush(struct ec_backlight_engine *engine)
+{
+	if (engine->worker)
+		kthread_flush_worker(engine->worker);
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_flush);
+
+void ec_backlight_engine_show_stats(struct ec_backlight_engine *engine,
+				    struct seq_file *m)
+{
+#ifdef CONFIG_EC_BACKLIGHT_ENGINE_STATS
+	u64 count = engine->stats.count;
+
+	seq_printf(m, "requests: %llu\n", count);
+	seq_printf(m, "coalesced: %llu\n", engine->stats.coalesced);
+	seq_printf(m, "failures: %llu\n", engine->stats.failures);
+	seq_printf(m, "delay_last_ns: %llu\n", engine->stats.last_ns);
+	seq_printf(m, "delay_max_ns: %llu\n", engine->stats.max_ns);
+	seq_printf(m, "delay_mean_ns: %llu\n",
+		   count ? div64_u64(engine->stats.total_ns, count) : 0);
+#endif
+	seq_printf(m, "set_latency_ns: %llu\n", READ_ONCE(engine->set_ns));
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_show_stats);
+
+static void engine_release(void *data)
+{
+	ec_backlight_engine_stop_worker(data);
+}
+
+/**
+ * ec_backlight_engine_create() - create an engine driving a firmware interface
+ * @dev:  device whose unbinding releases the engine
+ * @ops:  the firmware interface
+ * @caps: EC_BACKLIGHT_ENGINE_CAP_* flags
+ * @data: passed to @ops
+ *
+ * Firmware calls run in the caller's context until a worker is started.
+ *
+ * Returns the engine, or an ERR_PTR() on failure.
+ */
+struct ec_backlight_engine *
+ec_backlight_engine_create(struct device *dev,
+			   const struct ec_backlight_engine_ops *ops,
+			   unsigned long caps, void *data)
+{
+	struct ec_backlight_engine *engine;
+	int ret;
+
+	if (!ops->set ||
+	    ((caps & EC_BACKLIGHT_ENGINE_CAP_GET) && !ops->get) ||
+	    ((caps & EC_BACKLIGHT_ENGINE_CAP_GET_MAX) && !ops->get_max))
+		return ERR_PTR(-EINVAL);
+
+	engine = devm_kzalloc(dev, sizeof(*engine), GFP_KERNEL);
+	if (!engine)
+		return ERR_PTR(-ENOMEM);
+
+	engine->ops = ops;
+	engine->caps = caps;
+	engine->data = data;
+	engine->shadow_level = -1;
+	mutex_init(&engine->worker_lock);
+	engine->policy = SCHED_FIFO;
+	engine->priority = 1;
+	cpumask_copy(&engine->cpus, cpu_possible_mask);
+	kthread_init_work(&engine->set_work, engine_set_work);
+	spin_lock_init(&engine->set_lock);
+	engine->pending_level = -1;
+
+	ret = devm_add_action_or_reset(dev, engine_release, engine);
+	if (ret)
+		return ERR_PTR(ret);
+
+	return engine;
+}
+EXPORT_SYMBOL_GPL(ec_backlight_engine_create);
+
+MODULE_DESCRIPTION("Asynchronous engine for firmware-mediated backlight drivers");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Asynchronous engine for backlight drivers whose brightness control goes
+ * through slow firmware methods (ACPI, WMI, EC mailboxes).
+ */
+
+#ifndef _EC_BACKLIGHT_ENGINE_H
+#define _EC_BACKLIGHT_ENGINE_H
+
+#include <linux/bits.h>
+#include <linux/types.h>
+
+struct cpumask;
+struct device;
+struct seq_file;
+struct ec_backlight_engine;
+
+/**
+ * struct ec_backlight_engine_ops - firmware interface driven by the engine
+ * @get:     read the level currently applied by the firmware
+ * @set:     have the firmware apply a level
+ * @get_max: read the maximum level supported by the firmware
+ *
+ * Each callback gets the data passed to ec_backlight_engine_create(), may
+ * sleep, and returns 0 on success or a negative error number. The engine
+ * never runs two callbacks at the same time.
+ */
+struct ec_backlight_engine_ops {
+	int (*get)(void *data, u32 *level);
+	int (*set)(void *data, u32 level);
+	int (*get_max)(void *data, u32 *max_level);
+};
+
+/*
+ * Capability flags of the firmware interface:
+ * @EC_BACKLIGHT_ENGINE_CAP_GET:      @get reads back the level; without it,
+ *                                    the engine reports its shadow level
+ * @EC_BACKLIGHT_ENGINE_CAP_GET_MAX:  @get_max is implemented
+ * @EC_BACKLIGHT_ENGINE_CAP_COALESCE: only the latest level matters, so level
+ *                                    writes may complete asynchronously on
+ *                                    the worker, dropping superseded ones
+ */
+#define EC_BACKLIGHT_ENGINE_CAP_GET		BIT(0)
+#define EC_BACKLIGHT_ENGINE_CAP_GET_MAX		BIT(1)
+#define EC_BACKLIGHT_ENGINE_CAP_COALESCE	BIT(2)
+
+/*
+ * Flags for ec_backlight_engine_set():
+ * @EC_BACKLIGHT_ENGINE_SET_FORCE:  write even if the level equals the shadow
+ * @EC_BACKLIGHT_ENGINE_SET_DIRECT: call the firmware in the caller's context,
+ *                                  bypassing the worker; only safe while the
+ *                                  worker is idle, e.g. when resuming
+ */
+#define EC_BACKLIGHT_ENGINE_SET_FORCE		BIT(0)
+#define EC_BACKLIGHT_ENGINE_SET_DIRECT		BIT(1)
+
+struct ec_backlight_engine *
+ec_backlight_engine_create(struct device *dev,
+			   const struct ec_backlight_engine_ops *ops,
+			   unsigned long caps, void *data);
+
+int ec_backlight_engine_start_worker(struct ec_backlight_engine *engine,
+				     const char *name);
+void ec_backlight_engine_stop_worker(struct ec_backlight_engine *engine);
+bool ec_backlight_engine_has_worker(struct ec_backlight_engine *engine);
+void ec_backlight_engine_flush(struct ec_backlight_engine *engine);
+
+int ec_backlight_engine_get(struct ec_backlight_engine *engine, u32 *level);
+int ec_backlight_engine_get_max(struct ec_backlight_engine *engine,
+				u32 *max_level);
+int ec_backlight_engine_set(struct ec_backlight_engine *engine, u32 level,
+			    unsigned int flags);
+
+int ec_backlight_engine_shadow(struct ec_backlight_engine *engine);
+void ec_backlight_engine_set_shadow(struct ec_backlight_engine *engine,
+				    int level);
+bool ec_backlight_engine_set_pending(struct ec_backlight_engine *engine);
+u64 ec_backlight_engine_set_latency(struct ec_backlight_engine *engine);
+
+int ec_backlight_engine_policy(struct ec_backlight_engine *engine);
+int ec_backlight_engine_set_policy(struct ec_backlight_engine *engine,
+				   int policy);
+int ec_backlight_engine_priority(struct ec_backlight_engine *engine);
+int ec_backlight_engine_set_priority(struct ec_backlight_engine *engine,
+				     int priority);
+void ec_backlight_engine_cpus(struct ec_backlight_engine *engine,
+			      struct cpumask *cpus);
+int ec_backlight_engine_set_cpus(struct ec_backlight_engine *engine,
+				 const struct cpumask *cpus);
+
+void ec_backlight_engine_show_stats(struct ec_backlight_engine *engine,
+				    struct seq_file *m);
+
+#endif /* _EC_BACKLIGHT_ENGINE_H */
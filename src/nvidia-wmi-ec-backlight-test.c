@@ -0,0 +1,537 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit stress test of the nvidia-wmi-ec-backlight locking.
+ *
+ * The driver is built into this module against its firmware simulator,
+ * without being registered as a WMI driver. Each test probes a fake WMI
+ * device relaying to a fake proxy target backlight, then hammers the driver
+ * from several kthreads: brightness updates and reads, changes made directly
+ * on the proxy target, suspend/resume cycles and, last, remove. Run it on a
+ * kernel with lockdep (and KCSAN) enabled to have the locking checked too.
+ */
+
+#ifndef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM
+#define CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM 1
+#endif
+#ifndef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_PROXY
+#define CONFIG_NVIDIA_WMI_EC_BACKLIGHT_PROXY 1
+#endif
+#ifndef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_RESUME_RESTORE
+#define CONFIG_NVIDIA_WMI_EC_BACKLIGHT_RESUME_RESTORE 1
+#endif
+/* The tracepoints belong to the driver module. */
+#undef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_TRACE
+
+#define NVIDIA_WMI_EC_BACKLIGHT_KUNIT
+#include "nvidia-wmi-ec-backlight.c"
+
+#include <kunit/test.h>
+#include <linux/debug_locks.h>
+#include <linux/kthread.h>
+#include <linux/rwsem.h>
+
+#define TEST_PROXY_NAME "nvidia_wmi_ec_backlight_test_proxy"
+#define TEST_EC_MAX     100
+/* Twice the EC's maximum, so that levels scale exactly both ways. */
+#define TEST_PROXY_MAX  (2 * TEST_EC_MAX)
+
+#define TEST_UPDATERS 4
+#define TEST_READERS  2
+#define TEST_THREADS  (TEST_UPDATERS + TEST_READERS + 2)
+
+static uint stress_ms = 1000;
+module_param(stress_ms, uint, 0644);
+MODULE_PARM_DESC(stress_ms, "How long each test hammers the driver.");
+
+/**
+ * struct stress_thread - a kthread hammering the driver
+ * @name:   what it does, for the report
+ * @ctx:    the test it belongs to
+ * @task:   the kthread, while it runs
+ * @ops:    number of operations done
+ * @errors: number of operations which failed
+ */
+struct stress_thread {
+	const char *name;
+	struct stress_ctx *ctx;
+	struct task_struct *task;
+	u64 ops;
+	u64 errors;
+};
+
+/**
+ * struct stress_ctx - state of one test
+ * @test:     the test
+ * @wdev:     the fake WMI device the driver is probed on
+ * @group:    devres group of everything probe allocated, released on remove
+ * @proxy:    the fake proxy target
+ * @bd:       the driver's backlight device, referenced until the test ends
+ * @freeze:   held for writing from suspend_late to resume_early, and for
+ *            reading around every other operation, standing in for the
+ *            freezer
+ * @resume_mismatches: resumes which left the EC at another level than @bd's
+ * @threads:  the kthreads
+ * @nthreads: number of @threads started
+ */
+struct stress_ctx {
+	struct kunit *test;
+	struct wmi_device *wdev;
+	void *group;
+	struct backlight_device *proxy;
+	struct backlight_device *bd;
+	struct rw_semaphore freeze;
+	atomic_t resume_mismatches;
+	struct stress_thread threads[TEST_THREADS];
+	unsigned int nthreads;
+};
+
+static int fake_proxy_update_status(struct backlight_device *bd)
+{
+	/* Take about as long as a real panel driver would. */
+	usleep_range(10, 20);
+	return 0;
+}
+
+static int fake_proxy_get_brightness(struct backlight_device *bd)
+{
+	return bd->props.brightness;
+}
+
+static const struct backlight_ops fake_proxy_ops = {
+	.update_status = fake_proxy_update_status,
+	.get_brightness = fake_proxy_get_brightness,
+};
+
+static void fake_wdev_release(struct device *dev)
+{
+	kfree(container_of(dev, struct wmi_device, dev));
+}
+
+static u32 sim_level(void)
+{
+	u32 level;
+
+	mutex_lock(&sim.lock);
+	level = sim.level;
+	mutex_unlock(&sim.lock);
+
+	return level;
+}
+
+/*
+ * Set a level the way the brightness sysfs attribute does, minus the uevent
+ * which would flood userspace.
+ */
+static int stress_set_level(struct backlight_device *bd, int level)
+{
+	int ret = -ENXIO;
+
+	mutex_lock(&bd->ops_lock);
+	if (bd->ops) {
+		bd->props.brightness = level;
+		ret = backlight_update_status(bd);
+	}
+	mutex_unlock(&bd->ops_lock);
+
+	return ret;
+}
+
+/* Read the level the way the actual_brightness sysfs attribute does. */
+static int stress_get_level(struct backlight_device *bd)
+{
+	int ret = -ENXIO;
+
+	mutex_lock(&bd->ops_lock);
+	if (bd->ops && bd->ops->get_brightness)
+		ret = bd->ops->get_brightness(bd);
+	mutex_unlock(&bd->ops_lock);
+
+	return ret;
+}
+
+static int stress_update(void *data)
+{
+	struct stress_thread *t = data;
+	struct stress_ctx *ctx = t->ctx;
+
+	while (!kthread_should_stop()) {
+		down_read(&ctx->freeze);
+		if (stress_set_level(ctx->bd, get_random_u32() % (TEST_EC_MAX + 1)))
+			t->errors++;
+		up_read(&ctx->freeze);
+		t->ops++;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static int stress_read(void *data)
+{
+	struct stress_thread *t = data;
+	struct stress_ctx *ctx = t->ctx;
+
+	while (!kthread_should_stop()) {
+		down_read(&ctx->freeze);
+		if (stress_get_level(ctx->bd) < 0)
+			t->errors++;
+		up_read(&ctx->freeze);
+		t->ops++;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* Change the proxy target's level directly, to be mirrored to the EC. */
+static int stress_proxy(void *data)
+{
+	struct stress_thread *t = data;
+	struct stress_ctx *ctx = t->ctx;
+
+	while (!kthread_should_stop()) {
+		down_read(&ctx->freeze);
+		if (stress_set_level(ctx->proxy,
+				     2 * (get_random_u32() % (TEST_EC_MAX + 1))))
+			t->errors++;
+		up_read(&ctx->freeze);
+		t->ops++;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/*
+ * Run suspend_late and resume_early against the simulator, which resets the
+ * EC level on resume, and check that the level was restored.
+ */
+static int stress_resume(void *data)
+{
+	struct stress_thread *t = data;
+	struct stress_ctx *ctx = t->ctx;
+	struct device *dev = &ctx->wdev->dev;
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
+
+	while (!kthread_should_stop()) {
+		down_write(&ctx->freeze);
+		/* The mirror work is freezable. */
+		flush_work(&priv->mirror_work);
+		if (nvidia_wmi_ec_backlight_suspend_late(dev) ||
+		    nvidia_wmi_ec_backlight_resume_early(dev))
+			t->errors++;
+		if (sim_level() != ctx->bd->props.brightness)
+			atomic_inc(&ctx->resume_mismatches);
+		up_write(&ctx->freeze);
+		t->ops++;
+		usleep_range(500, 1000);
+	}
+
+	return 0;
+}
+
+static void stress_start(struct stress_ctx *ctx, const char *name,
+			 int (*fn)(void *data))
+{
+	struct stress_thread *t = &ctx->threads[ctx->nthreads];
+	struct task_struct *task;
+
+	t->name = name;
+	t->ctx = ctx;
+	task = kthread_run(fn, t, "nvbl-test-%s", name);
+	KUNIT_ASSERT_FALSE_MSG(ctx->test, IS_ERR(task),
+			       "Unable to start %s thread: %ld", name,
+			       PTR_ERR(task));
+	t->task = task;
+	ctx->nthreads++;
+}
+
+static void stress_stop(struct stress_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nthreads; i++) {
+		if (ctx->threads[i].task) {
+			kthread_stop(ctx->threads[i].task);
+			ctx->threads[i].task = NULL;
+		}
+	}
+}
+
+/* Sum up and report the operations of the threads named name. */
+static void stress_report(struct stress_ctx *ctx, const char *name,
+			  bool expect_errors)
+{
+	struct kunit *test = ctx->test;
+	u64 ops = 0, errors = 0;
+	unsigned int i;
+
+	for (i = 0; i < ctx->nthreads; i++) {
+		struct stress_thread *t = &ctx->threads[i];
+
+		if (strcmp(t->name, name))
+			continue;
+
+		KUNIT_EXPECT_GT_MSG(test, t->ops, 0ULL,
+				    "A %s thread made no progress", name);
+		ops += t->ops;
+		errors += t->errors;
+	}
+
+	kunit_info(test, "%s: %llu ops, %llu/s, %llu errors\n", name, ops,
+		   div_u64(ops * MSEC_PER_SEC, max(stress_ms, 1U)), errors);
+	if (expect_errors)
+		KUNIT_EXPECT_GT(test, errors, 0ULL);
+	else
+		KUNIT_EXPECT_EQ(test, errors, 0ULL);
+}
+
+/* Undo stress_init(), as far as it got. */
+static void stress_teardown(struct stress_ctx *ctx)
+{
+	stress_stop(ctx);
+
+	if (ctx->group) {
+		nvidia_wmi_ec_backlight_remove(ctx->wdev);
+		devres_release_group(&ctx->wdev->dev, ctx->group);
+		dev_set_drvdata(&ctx->wdev->dev, NULL);
+		ctx->group = NULL;
+	}
+	if (ctx->bd) {
+		put_device(&ctx->bd->dev);
+		ctx->bd = NULL;
+	}
+	if (ctx->wdev) {
+		device_unregister(&ctx->wdev->dev);
+		ctx->wdev = NULL;
+	}
+	if (ctx->proxy) {
+		backlight_device_unregister(ctx->proxy);
+		ctx->proxy = NULL;
+	}
+}
+
+static int stress_setup(struct stress_ctx *ctx)
+{
+	struct backlight_properties props = {
+		.type = BACKLIGHT_RAW,
+		.max_brightness = TEST_PROXY_MAX,
+		.brightness = TEST_PROXY_MAX / 2,
+	};
+	struct nvidia_wmi_ec_backlight_priv *priv;
+	struct wmi_device *wdev;
+	int ret;
+
+	ctx->proxy = backlight_device_register(TEST_PROXY_NAME, NULL, NULL,
+					       &fake_proxy_ops, &props);
+	if (IS_ERR(ctx->proxy)) {
+		ret = PTR_ERR(ctx->proxy);
+		ctx->proxy = NULL;
+		return ret;
+	}
+
+	wdev = kzalloc(sizeof(*wdev), GFP_KERNEL);
+	if (!wdev)
+		return -ENOMEM;
+
+	device_initialize(&wdev->dev);
+	wdev->dev.release = fake_wdev_release;
+	ret = dev_set_name(&wdev->dev, "nvidia-wmi-ec-backlight-test");
+	if (!ret)
+		ret = device_add(&wdev->dev);
+	if (ret) {
+		put_device(&wdev->dev);
+		return ret;
+	}
+	ctx->wdev = wdev;
+
+	ctx->group = devres_open_group(&wdev->dev, NULL, GFP_KERNEL);
+	if (!ctx->group)
+		return -ENOMEM;
+
+	ret = nvidia_wmi_ec_backlight_probe(wdev, NULL);
+	devres_close_group(&wdev->dev, ctx->group);
+	if (ret) {
+		devres_release_group(&wdev->dev, ctx->group);
+		ctx->group = NULL;
+		return ret;
+	}
+
+	priv = dev_get_drvdata(&wdev->dev);
+	ctx->bd = priv->bl_dev;
+	get_device(&ctx->bd->dev);
+
+	return 0;
+}
+
+static int stress_init(struct kunit *test)
+{
+	struct backlight_device *bd;
+	struct stress_ctx *ctx;
+	int ret;
+
+	bd = backlight_device_get_by_name("nvidia_wmi_ec_backlight");
+	if (bd) {
+		put_device(&bd->dev);
+		kunit_skip(test, "nvidia-wmi-ec-backlight is bound already");
+	}
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx);
+	ctx->test = test;
+	init_rwsem(&ctx->freeze);
+	atomic_set(&ctx->resume_mismatches, 0);
+	test->priv = ctx;
+
+	mutex_lock(&sim.lock);
+	sim.source = WMI_BRIGHTNESS_SOURCE_EC;
+	sim.level = TEST_EC_MAX;
+	sim.max_level = TEST_EC_MAX;
+	sim.panel_level = TEST_EC_MAX;
+	sim.step = 1;
+	sim.fail_percent = 0;
+	sim.latency_us = 20;
+	sim.latency_per_level_ns = 0;
+	sim.reset_on_resume = true;
+	sim.gpu_owns_panel = false;
+	mutex_unlock(&sim.lock);
+
+	backlight_proxy_target = TEST_PROXY_NAME;
+	bidirectional_proxy = true;
+	restore_level_on_resume = true;
+	ec_worker = *(const bool *)test->param_value;
+	thermal_states = 0;
+
+	ret = stress_setup(ctx);
+	if (ret)
+		stress_teardown(ctx);
+	KUNIT_ASSERT_EQ_MSG(test, ret, 0, "Unable to probe the fake device");
+
+	return 0;
+}
+
+static void stress_exit(struct kunit *test)
+{
+	struct stress_ctx *ctx = test->priv;
+
+	if (ctx)
+		stress_teardown(ctx);
+}
+
+/*
+ * Hammer every path at once, then check that the EC, the proxy target and
+ * the state device all ended up at the last level requested.
+ */
+static void nvidia_wmi_ec_backlight_test_stress(struct kunit *test)
+{
+	struct stress_ctx *ctx = test->priv;
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(&ctx->wdev->dev);
+	u64 calls;
+	int level, i;
+
+	mutex_lock(&sim.lock);
+	calls = sim.calls;
+	mutex_unlock(&sim.lock);
+
+	for (i = 0; i < TEST_UPDATERS; i++)
+		stress_start(ctx, "update", stress_update);
+	for (i = 0; i < TEST_READERS; i++)
+		stress_start(ctx, "read", stress_read);
+	stress_start(ctx, "proxy", stress_proxy);
+	stress_start(ctx, "resume", stress_resume);
+
+	msleep(stress_ms);
+	stress_stop(ctx);
+
+	flush_work(&priv->mirror_work);
+	ec_backlight_engine_flush(priv->engine);
+
+	stress_report(ctx, "update", false);
+	stress_report(ctx, "read", false);
+	stress_report(ctx, "proxy", false);
+	stress_report(ctx, "resume", false);
+
+	mutex_lock(&sim.lock);
+	calls = sim.calls - calls;
+	mutex_unlock(&sim.lock);
+	kunit_info(test, "EC calls: %llu, %llu/s\n", calls,
+		   div_u64(calls * MSEC_PER_SEC, max(stress_ms, 1U)));
+
+	KUNIT_EXPECT_EQ(test, atomic_read(&ctx->resume_mismatches), 0);
+
+	mutex_lock(&ctx->bd->ops_lock);
+	level = ctx->bd->props.brightness;
+	mutex_unlock(&ctx->bd->ops_lock);
+
+	KUNIT_EXPECT_EQ(test, sim_level(), (u32)level);
+	KUNIT_EXPECT_EQ(test, READ_ONCE(priv->ec_level), (u32)level);
+	KUNIT_EXPECT_EQ(test, ctx->proxy->props.brightness, 2 * level);
+	KUNIT_EXPECT_EQ(test, READ_ONCE(priv->shm->state->level), (u32)level);
+
+	/* One more request once things have settled has to land everywhere. */
+	level = (level + TEST_EC_MAX / 2) % (TEST_EC_MAX + 1);
+	KUNIT_EXPECT_EQ(test, stress_set_level(ctx->bd, level), 0);
+	ec_backlight_engine_flush(priv->engine);
+	KUNIT_EXPECT_EQ(test, sim_level(), (u32)level);
+	KUNIT_EXPECT_EQ(test, ctx->proxy->props.brightness, 2 * level);
+
+	KUNIT_EXPECT_TRUE_MSG(test, debug_locks, "Lockdep reported a problem");
+}
+
+/*
+ * Remove the driver while it is being hammered: calls made afterwards have
+ * to fail cleanly, and the proxy target has to get its own ops back.
+ */
+static void nvidia_wmi_ec_backlight_test_remove(struct kunit *test)
+{
+	struct stress_ctx *ctx = test->priv;
+
+	stress_start(ctx, "update", stress_update);
+	stress_start(ctx, "update", stress_update);
+	stress_start(ctx, "read", stress_read);
+	stress_start(ctx, "proxy", stress_proxy);
+
+	msleep(stress_ms / 2);
+
+	nvidia_wmi_ec_backlight_remove(ctx->wdev);
+	devres_release_group(&ctx->wdev->dev, ctx->group);
+	dev_set_drvdata(&ctx->wdev->dev, NULL);
+	ctx->group = NULL;
+
+	KUNIT_EXPECT_PTR_EQ(test, ctx->proxy->ops, &fake_proxy_ops);
+
+	msleep(stress_ms / 2);
+	stress_stop(ctx);
+
+	stress_report(ctx, "update", true);
+	stress_report(ctx, "read", true);
+	stress_report(ctx, "proxy", false);
+
+	KUNIT_EXPECT_TRUE_MSG(test, debug_locks, "Lockdep reported a problem");
+}
+
+static const bool ec_worker_params[] = { false, true };
+
+static void ec_worker_param_desc(const bool *param, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "ec_worker=%d", *param);
+}
+
+KUNIT_ARRAY_PARAM(ec_worker, ec_worker_params, ec_worker_param_desc);
+
+static struct kunit_case nvidia_wmi_ec_backlight_test_cases[] = {
+	KUNIT_CASE_PARAM(nvidia_wmi_ec_backlight_test_stress, ec_worker_gen_params),
+	KUNIT_CASE_PARAM(nvidia_wmi_ec_backlight_test_remove, ec_worker_gen_params),
+	{ }
+};
+
+static struct kunit_suite nvidia_wmi_ec_backlight_test_suite = {
+	.name = "nvidia-wmi-ec-backlight",
+	.init = stress_init,
+	.exit = stress_exit,
+	.test_cases = nvidia_wmi_ec_backlight_test_cases,
+};
+kunit_test_suite(nvidia_wmi_ec_backlight_test_suite);
+
+MODULE_DESCRIPTION("KUnit stress test of the NVIDIA WMI EC Backlight driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM nvidia_wmi_ec_backlight
+
+#ifndef _NVIDIA_WMI_EC_BACKLIGHT_TRACE_TYPES
+#define _NVIDIA_WMI_EC_BACKLIGHT_TRACE_TYPES
+
+/**
+ * enum nvidia_wmi_ec_backlight_source - origin of a brightness request
+ * @NVIDIA_WMI_EC_BACKLIGHT_SRC_UPDATE: update_status, i.e. a sysfs write or an
+ *                                      in-kernel backlight_device_set_brightness()
+ * @NVIDIA_WMI_EC_BACKLIGHT_SRC_RESUME: level restore when resuming
+ * @NVIDIA_WMI_EC_BACKLIGHT_SRC_MIRROR: change mirrored from the proxy target
+ * @NVIDIA_WMI_EC_BACKLIGHT_SRC_THERMAL: thermal cap change
+ * @NVIDIA_WMI_EC_BACKLIGHT_SRC_DRIFT: re-application after the EC level drifted
+ * @NVIDIA_WMI_EC_BACKLIGHT_SRC_HOTKEY: brightness key handled in the kernel
+ */
+enum nvidia_wmi_ec_backlight_source {
+	NVIDIA_WMI_EC_BACKLIGHT_SRC_UPDATE,
+	NVIDIA_WMI_EC_BACKLIGHT_SRC_RESUME,
+	NVIDIA_WMI_EC_BACKLIGHT_SRC_MIRROR,
+	NVIDIA_WMI_EC_BACKLIGHT_SRC_THERMAL,
+	NVIDIA_WMI_EC_BACKLIGHT_SRC_DRIFT,
+	NVIDIA_WMI_EC_BACKLIGHT_SRC_HOTKEY,
+};
+
+/**
+ * enum nvidia_wmi_ec_backlight_phase - timed phases of probe and resume
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_QUIRKS:       DMI quirk matching
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_PROXY_LOOKUP: proxy target lookup
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_SOURCE:       brightness source query
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX_LEVEL:    maximum level query
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_LEVEL:        current level query, or saved level write
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_REGISTER:     backlight device registration
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_IMPORT:       proxy target level import
+ * @NVIDIA_WMI_EC_BACKLIGHT_PHASE_RESUME:       level restore on resume
+ */
+enum nvidia_wmi_ec_backlight_phase {
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_QUIRKS,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_PROXY_LOOKUP,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_SOURCE,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX_LEVEL,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_LEVEL,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_REGISTER,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_IMPORT,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_RESUME,
+	NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX
+};
+
+#ifndef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_TRACE
+/* Tracing is compiled out; keep the call sites type-checked. */
+static inline void
+trace_nvidia_wmi_ec_backlight_request(enum nvidia_wmi_ec_backlight_source source,
+				      int level) { }
+static inline void
+trace_nvidia_wmi_ec_backlight_ec_call(u32 method, u32 mode, u32 val, int ret,
+				      u64 duration_ns) { }
+static inline void
+trace_nvidia_wmi_ec_backlight_phase(enum nvidia_wmi_ec_backlight_phase phase,
+				    u64 duration_ns) { }
+static inline void
+trace_nvidia_wmi_ec_backlight_probe_defer(int attempt,
+					  u64 since_first_probe_ns) { }
+#endif
+
+#endif /* _NVIDIA_WMI_EC_BACKLIGHT_TRACE_TYPES */
+
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_TRACE
+
+#if !defined(_NVIDIA_WMI_EC_BACKLIGHT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _NVIDIA_WMI_EC_BACKLIGHT_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_SRC_UPDATE);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_SRC_RESUME);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_SRC_MIRROR);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_SRC_THERMAL);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_SRC_DRIFT);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_SRC_HOTKEY);
+
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_QUIRKS);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_PROXY_LOOKUP);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_SOURCE);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX_LEVEL);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_LEVEL);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_REGISTER);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_IMPORT);
+TRACE_DEFINE_ENUM(NVIDIA_WMI_EC_BACKLIGHT_PHASE_RESUME);
+
+#define show_phase(phase)						\
+	__print_symbolic(phase,						\
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_QUIRKS, "quirks" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_PROXY_LOOKUP, "proxy_lookup" }, \
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_SOURCE, "source" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX_LEVEL, "max_level" }, \
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_LEVEL, "level" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_REGISTER, "register" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_IMPORT, "import" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_PHASE_RESUME, "resume" })
+
+#define show_request_source(src)					\
+	__print_symbolic(src,						\
+		{ NVIDIA_WMI_EC_BACKLIGHT_SRC_UPDATE, "update" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_SRC_RESUME, "resume" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_SRC_MIRROR, "mirror" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_SRC_THERMAL, "thermal" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_SRC_DRIFT, "drift" },	\
+		{ NVIDIA_WMI_EC_BACKLIGHT_SRC_HOTKEY, "hotkey" })
+
+TRACE_EVENT(nvidia_wmi_ec_backlight_request,
+
+	TP_PROTO(enum nvidia_wmi_ec_backlight_source source, int level),
+
+	TP_ARGS(source, level),
+
+	TP_STRUCT__entry(
+		__field(int, source)
+		__field(int, level)
+	),
+
+	TP_fast_assign(
+		__entry->source = source;
+		__entry->level = level;
+	),
+
+	TP_printk("source=%s level=%d",
+		  show_request_source(__entry->source), __entry->level)
+);
+
+TRACE_EVENT(nvidia_wmi_ec_backlight_ec_call,
+
+	TP_PROTO(u32 method, u32 mode, u32 val, int ret, u64 duration_ns),
+
+	TP_ARGS(method, mode, val, ret, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(u32, method)
+		__field(u32, mode)
+		__field(u32, val)
+		__field(int, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->method = method;
+		__entry->mode = mode;
+		__entry->val = val;
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("method=%u mode=%u val=%u ret=%d duration_ns=%llu",
+		  __entry->method, __entry->mode, __entry->val, __entry->ret,
+		  __entry->duration_ns)
+);
+
+TRACE_EVENT(nvidia_wmi_ec_backlight_phase,
+
+	TP_PROTO(enum nvidia_wmi_ec_backlight_phase phase, u64 duration_ns),
+
+	TP_ARGS(phase, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(int, phase)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->phase = phase;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("phase=%s duration_ns=%llu",
+		  show_phase(__entry->phase), __entry->duration_ns)
+);
+
+TRACE_EVENT(nvidia_wmi_ec_backlight_probe_defer,
+
+	TP_PROTO(int attempt, u64 since_first_probe_ns),
+
+	TP_ARGS(attempt, since_first_probe_ns),
+
+	TP_STRUCT__entry(
+		__field(int, attempt)
+		__field(u64, since_first_probe_ns)
+	),
+
+	TP_fast_assign(
+		__entry->attempt = attempt;
+		__entry->since_first_probe_ns = since_first_probe_ns;
+	),
+
+	TP_printk("attempt=%d since_first_probe_ns=%llu",
+		  __entry->attempt, __entry->since_first_probe_ns)
+);
+
+#endif /* _NVIDIA_WMI_EC_BACKLIGHT_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE nvidia-wmi-ec-backlight-trace
+#include <trace/define_trace.h>
+
+#endif /* CONFIG_NVIDIA_WMI_EC_BACKLIGHT_TRACE */
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+/*
+ * Userspace interface of the nvidia-wmi-ec-backlight character devices.
+ */
+
+#ifndef _UAPI_NVIDIA_WMI_EC_BACKLIGHT_H
+#define _UAPI_NVIDIA_WMI_EC_BACKLIGHT_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/**
+ * struct nvidia_wmi_ec_backlight_state - brightness state page
+ * @seq:       sequence counter, odd while the driver is updating the page
+ * @level:     current level of the backlight device
+ * @max_level: maximum level of the backlight device
+ * @ec_level:  last level the EC confirmed, by accepting or reporting it
+ *
+ * The page is mapped read-only by mmap() of /dev/nvidia-wmi-ec-backlight-<wmi>
+ * at offset 0, where <wmi> is the name of the WMI device the backlight belongs
+ * to, e.g. 603E9613-EF25-4338-A3D0-C46177516DB7. To take a consistent
+ * snapshot without a syscall, read @seq, then the other fields, then @seq
+ * again, with read barriers in between, and retry while @seq was odd or
+ * changed.
+ *
+ * poll() reports the device readable once the page has changed since the
+ * file was opened or last read(). read() returns a snapshot of this struct.
+ */
+struct nvidia_wmi_ec_backlight_state {
+	__u32 seq;
+	__u32 level;
+	__u32 max_level;
+	__u32 ec_level;
+};
+
+/* Number of keyframes in the animation ring. */
+#define NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES 128
+
+/**
+ * enum nvidia_wmi_ec_backlight_keyframe_status - outcome of a keyframe
+ * @NVIDIA_WMI_EC_BACKLIGHT_KF_PENDING: not consumed yet
+ * @NVIDIA_WMI_EC_BACKLIGHT_KF_DONE:    written to the EC in time
+ * @NVIDIA_WMI_EC_BACKLIGHT_KF_MISSED:  its deadline could no longer be met.
+ *                                      It is not written, unless it is the
+ *                                      last queued keyframe, which is written
+ *                                      late so that the animation still ends
+ *                                      at its final level.
+ * @NVIDIA_WMI_EC_BACKLIGHT_KF_SKIPPED: superseded by a later keyframe which
+ *                                      was already due
+ */
+enum nvidia_wmi_ec_backlight_keyframe_status {
+	NVIDIA_WMI_EC_BACKLIGHT_KF_PENDING,
+	NVIDIA_WMI_EC_BACKLIGHT_KF_DONE,
+	NVIDIA_WMI_EC_BACKLIGHT_KF_MISSED,
+	NVIDIA_WMI_EC_BACKLIGHT_KF_SKIPPED,
+};
+
+/**
+ * struct nvidia_wmi_ec_backlight_keyframe - a brightness animation keyframe
+ * @deadline_ns: CLOCK_MONOTONIC time at which @level should be reached
+ * @level:       brightness level, clamped to the maximum level
+ * @status:      &enum nvidia_wmi_ec_backlight_keyframe_status, set by the
+ *               driver when the keyframe is consumed
+ */
+struct nvidia_wmi_ec_backlight_keyframe {
+	__u64 deadline_ns;
+	__u32 level;
+	__u32 status;
+};
+
+/**
+ * struct nvidia_wmi_ec_backlight_ring - brightness animation ring
+ * @head:    free-running index of the next keyframe slot to fill; written by
+ *           userspace
+ * @tail:    free-running index of the next keyframe to consume; written by
+ *           the driver
+ * @done:    number of keyframes written in time
+ * @missed:  number of keyframes whose deadline could not be met
+ * @skipped: number of keyframes superseded by later ones
+ * @frames:  keyframe slots, indexed modulo %NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES
+ *
+ * Mapped read-write by mmap() of one page of
+ * /dev/nvidia-wmi-ec-backlight-anim-<wmi>, named like the state device.
+ * Userspace fills frames[head] onwards, with deadlines in increasing order,
+ * publishes them by advancing @head (with a write barrier) and then issues
+ * %NVIDIA_WMI_EC_BACKLIGHT_IOC_KICK. At most
+ * %NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES keyframes may be outstanding.
+ *
+ * poll() reports POLLOUT while there is room in the ring, and POLLIN once
+ * every queued keyframe has been consumed. Only one process may have the
+ * device open at a time.
+ */
+struct nvidia_wmi_ec_backlight_ring {
+	__u32 head;
+	__u32 tail;
+	__u32 done;
+	__u32 missed;
+	__u32 skipped;
+	__u32 reserved[11];
+	struct nvidia_wmi_ec_backlight_keyframe frames[NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES];
+};
+
+/* Start consuming keyframes queued since the last kick. */
+#define NVIDIA_WMI_EC_BACKLIGHT_IOC_KICK _IO('N', 0xe0)
+
+#endif /* _UAPI_NVIDIA_WMI_EC_BACKLIGHT_H */
@@ -7,12 +7,40 @@
 
 #include <linux/acpi.h>
 #include <linux/backlight.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/dmi.h>
+#include <linux/firmware.h>
 #include <linux/fixp-arith.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
+#include <linux/lockdep.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/mod_devicetable.h>
 #include <linux/module.h>
+#include <linux/pm.h>
+#include <linux/poll.h>
+#include <linux/power_supply.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/thermal.h>
 #include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
 #include <linux/wmi.h>
+#include <linux/workqueue.h>
+
+#include <acpi/button.h>
+
+#include "ec-backlight-engine.h"
+#include "nvidia-wmi-ec-backlight-uapi.h"
+
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_TRACE
+#define CREATE_TRACE_POINTS
+#endif
+#include "nvidia-wmi-ec-backlight-trace.h"
 
 /**
  * enum wmi_brightness_method - WMI method IDs
@@ -79,29 +107,179 @@ struct wmi_brightness_args {
 	u32 ignored[3];
 };
 
+/**
+ * struct nvidia_wmi_ec_backlight_timing - probe and resume phase durations
+ * @phase_ns:       duration of the latest run of each phase
+ * @probe_ns:       duration of the successful probe attempt
+ * @defer_count:    number of probe attempts deferred waiting for the proxy
+ *                  target
+ * @defer_wait_ns:  time from the first probe attempt to the successful one
+ *
+ * Part of the private data, exposed in debugfs as "timings". The deferral
+ * figures are carried over from earlier probe attempts.
+ */
+struct nvidia_wmi_ec_backlight_timing {
+	u64 phase_ns[NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX];
+	u64 probe_ns;
+	int defer_count;
+	u64 defer_wait_ns;
+};
+
 /**
  * struct nvidia_wmi_ec_backlight_priv - driver private data
+ * @wdev:         the WMI device
  * @bl_dev:       the associated backlight device
  * @proxy_target: backlight device which receives relayed brightness changes
- * @notifier:     notifier block for resume callback
+ * @bl_nb:        notifier block for backlight device unregistration events
+ * @proxy_ops:    copy of the proxy target's ops with update_status hooked, so
+ *                that changes made directly on the proxy target are mirrored
+ * @proxy_orig_ops: the proxy target's original ops, while hooked
+ * @mirror_work:  mirrors a proxy target level change back to the EC
+ * @relay_level:  level currently being relayed to the proxy target, or -1;
+ *                used to keep relayed changes from being mirrored back
+ * @debugfs:      debugfs directory of this device
+ * @timing:       probe and resume phase durations of this device
+ * @engine:       queues, coalesces and elides EC level calls, optionally on
+ *                a dedicated worker
+ * @ec_level:     last level confirmed by the EC
+ * @shm:          brightness state page shared with userspace
+ * @anim:         keyframe animation device
+ * @cdev:         thermal cooling device
+ * @cap_state:    current cooling state; each state lowers the level cap
+ * @drift_work:   samples the EC level and re-applies the requested level on drift
+ * @drift_interval_ms: current sampling interval of @drift_work
+ * @drift_level:  level last re-applied by @drift_work, or -1
+ * @drift_ec_level: level the EC reported right after @drift_level was
+ *                re-applied; differs from it on firmware which quantizes
+ * @psy_nb:       notifier block for power supply changes
+ * @lid_nb:       notifier block for lid switch changes
+ * @drift_checks: number of EC level samples taken by @drift_work
+ * @drift_fixes:  number of times drift was detected and corrected
+ * @hotkey_handler: input handler consuming brightness key events
+ * @hotkey_work:  applies @hotkey_delta
+ * @hotkey_delta: level change accumulated from brightness keys, not yet applied
+ *
+ * Locking: the ops_lock of @bl_dev may be held while taking the ops_lock of
+ * @proxy_target (relaying), never the other way around. Code running under
+ * the proxy target's ops_lock (the hooked update_status) defers any work on
+ * @bl_dev to @mirror_work. @bl_dev's ops_lock gets its own lockdep class so
+ * that this nesting is not mistaken for recursive locking.
  */
 struct nvidia_wmi_ec_backlight_priv {
+	struct wmi_device *wdev;
 	struct backlight_device *bl_dev;
 	struct backlight_device *proxy_target;
-	struct notifier_block nb;
+	struct notifier_block bl_nb;
+	struct backlight_ops proxy_ops;
+	const struct backlight_ops *proxy_orig_ops;
+	struct work_struct mirror_work;
+	atomic_t relay_level;
+	struct dentry *debugfs;
+	struct nvidia_wmi_ec_backlight_timing timing;
+	struct ec_backlight_engine *engine;
+	u32 ec_level;
+	struct nvidia_wmi_ec_backlight_shm *shm;
+	struct nvidia_wmi_ec_backlight_anim *anim;
+	struct thermal_cooling_device *cdev;
+	unsigned long cap_state;
+	struct delayed_work drift_work;
+	unsigned int drift_interval_ms;
+	int drift_level;
+	u32 drift_ec_level;
+	struct notifier_block psy_nb;
+	struct notifier_block lid_nb;
+	u64 drift_checks;
+	u64 drift_fixes;
+	struct input_handler hotkey_handler;
+	struct work_struct hotkey_work;
+	atomic_t hotkey_delta;
 };
 
+static struct lock_class_key nvidia_wmi_ec_backlight_ops_lock_key;
+
+/*
+ * Parameters of features which are compiled out (see Kbuild) turn into
+ * constants, so that the compiler drops the code depending on them.
+ */
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_PROXY
 static char *backlight_proxy_target;
 module_param(backlight_proxy_target, charp, 0444);
 MODULE_PARM_DESC(backlight_proxy_target, "Relay brightness change requests to the named backlight driver, on systems which erroneously report EC backlight control.");
 
+static bool bidirectional_proxy;
+module_param(bidirectional_proxy, bool, 0444);
+MODULE_PARM_DESC(bidirectional_proxy, "Also mirror brightness changes made directly on the proxy target back to the EC.");
+
 static int max_reprobe_attempts = 128;
 module_param(max_reprobe_attempts, int, 0444);
 MODULE_PARM_DESC(max_reprobe_attempts, "Limit of reprobe attempts when relaying brightness change requests.");
+#else
+#define backlight_proxy_target ""
+#define bidirectional_proxy false
+#define max_reprobe_attempts 0
+#endif
+
+static bool ec_worker;
+module_param(ec_worker, bool, 0444);
+MODULE_PARM_DESC(ec_worker, "Execute EC calls on a dedicated kthread, whose scheduling policy, priority and CPU affinity can be changed through sysfs. Brightness changes are applied asynchronously, keeping only the latest.");
+
+static uint anim_slack_us = 4000;
+module_param(anim_slack_us, uint, 0644);
+MODULE_PARM_DESC(anim_slack_us, "How late an animation keyframe may reach the EC and still count as on time.");
+
+static uint thermal_states = 10;
+module_param(thermal_states, uint, 0444);
+MODULE_PARM_DESC(thermal_states, "Number of thermal cooling states, each lowering the maximum backlight level further; 0 to not register a cooling device.");
 
+static uint thermal_min_percent = 20;
+module_param(thermal_min_percent, uint, 0444);
+MODULE_PARM_DESC(thermal_min_percent, "Backlight level cap, in percent of the maximum level, at the highest thermal cooling state.");
+
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_RESUME_RESTORE
 static bool restore_level_on_resume;
 module_param(restore_level_on_resume, bool, 0444);
-MODULE_PARM_DESC(restore_level_on_resume, "Restore the backlight level when resuming from suspend, on systems which reset the EC's backlight level on resume.");
+MODULE_PARM_DESC(restore_level_on_resume, "Restore the backlight level when resuming from suspend or hibernation, on systems which reset the EC's backlight level on resume.");
+#else
+#define restore_level_on_resume false
+#endif
+
+static uint drift_min_interval_ms = 500;
+static uint drift_max_interval_ms = 64000;
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_DRIFT
+static bool drift_check;
+module_param(drift_check, bool, 0444);
+MODULE_PARM_DESC(drift_check, "Periodically verify the EC backlight level and re-apply it, on systems whose EC changes the level on its own, e.g. on AC, dock or lid events.");
+
+module_param(drift_min_interval_ms, uint, 0644);
+MODULE_PARM_DESC(drift_min_interval_ms, "EC level verification interval right after drift, or a power supply or lid event.");
+
+module_param(drift_max_interval_ms, uint, 0644);
+MODULE_PARM_DESC(drift_max_interval_ms, "Longest EC level verification interval, reached by doubling while the level is stable.");
+#else
+#define drift_check false
+#endif
+
+static bool hotkeys;
+module_param(hotkeys, bool, 0444);
+MODULE_PARM_DESC(hotkeys, "Handle the brightness up and down keys in the kernel instead of passing them on to userspace.");
+
+static uint hotkey_step_percent = 5;
+module_param(hotkey_step_percent, uint, 0644);
+MODULE_PARM_DESC(hotkey_step_percent, "Level change per brightness key press, in percent of the maximum level.");
+
+static uint hotkey_accel_max = 4;
+module_param(hotkey_accel_max, uint, 0644);
+MODULE_PARM_DESC(hotkey_accel_max, "Largest step multiplier reached while a brightness key is held down; 1 disables acceleration.");
+
+static char *saved_level;
+module_param(saved_level, charp, 0444);
+MODULE_PARM_DESC(saved_level, "Backlight level to apply when probing, as a comma separated list of product=level entries matched against the DMI product name or version; a bare level matches any product.");
+
+static char *saved_level_file;
+module_param(saved_level_file, charp, 0444);
+MODULE_PARM_DESC(saved_level_file, "Firmware file, e.g. provided by the initramfs, holding saved_level entries one per line; used when saved_level has no match.");
+
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_QUIRKS
 
 /* Bit field values for quirks table */
 
@@ -116,14 +294,18 @@ MODULE_PARM_DESC(restore_level_on_resume, "Restore the backlight level when resu
 
 static int assign_quirks(const struct dmi_system_id *id)
 {
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_RESUME_RESTORE
 	if (HAS_QUIRK(id->driver_data, RESTORE_LEVEL_ON_RESUME))
 		restore_level_on_resume = 1;
+#endif
 
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_PROXY
 	/* If the module parameter is set, override the quirks table */
 	if (!backlight_proxy_target) {
 		if (HAS_QUIRK(id->driver_data, PROXY_TO_AMDGPU))
 			backlight_proxy_target = "amdgpu_bl0";
 	}
+#endif
 
 	return true;
 }
@@ -146,6 +328,403 @@ static const struct dmi_system_id quirks_table[] = {
 	{ }
 };
 
+/*
+ * Check quirks tables to see if this system needs any of the firmware bug
+ * workarounds.
+ */
+static void check_quirks(void)
+{
+	dmi_check_system(quirks_table);
+}
+
+#else
+
+static void check_quirks(void) { }
+
+#endif /* CONFIG_NVIDIA_WMI_EC_BACKLIGHT_QUIRKS */
+
+#ifdef CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM
+
+/**
+ * struct wmi_brightness_sim - simulated WmiBrightnessNotify firmware
+ * @lock:                 serializes evaluations, as the firmware would
+ * @source:               &enum wmi_brightness_source value to report
+ * @level:                level held by the simulated EC
+ * @max_level:            maximum level reported by the simulated EC
+ * @panel_level:          level actually shown on the simulated panel
+ * @step:                 quantization step applied to levels being set
+ * @fail_percent:         percentage of evaluations which fail
+ * @latency_us:           base latency of each evaluation
+ * @latency_per_level_ns: additional latency per unit of the level set or held
+ * @reset_on_resume:      reset @level to @max_level when resuming
+ * @gpu_owns_panel:       leave @panel_level alone when @level is set, as if
+ *                        the GPU controlled the panel despite @source
+ * @calls:                number of evaluations
+ * @failures:             number of injected evaluation failures
+ *
+ * Models the firmware bugs which the workarounds in this driver deal with,
+ * so that they can be exercised on systems whose firmware behaves. Every
+ * field can be changed at runtime through debugfs.
+ */
+struct wmi_brightness_sim {
+	struct mutex lock;
+	u32 source;
+	u32 level;
+	u32 max_level;
+	u32 panel_level;
+	u32 step;
+	u32 fail_percent;
+	u32 latency_us;
+	u32 latency_per_level_ns;
+	bool reset_on_resume;
+	bool gpu_owns_panel;
+	u64 calls;
+	u64 failures;
+};
+
+static struct wmi_brightness_sim sim = {
+	.lock = __MUTEX_INITIALIZER(sim.lock),
+	.source = WMI_BRIGHTNESS_SOURCE_EC,
+	.level = 100,
+	.max_level = 100,
+	.panel_level = 100,
+	.step = 1,
+	.reset_on_resume = true,
+};
+
+static acpi_status wmi_brightness_sim_evaluate(u32 id, struct wmi_brightness_args *args)
+{
+	acpi_status status = AE_OK;
+	u32 level;
+
+	mutex_lock(&sim.lock);
+
+	sim.calls++;
+	level = args->mode == WMI_BRIGHTNESS_MODE_SET ? args->val : sim.level;
+	fsleep(sim.latency_us +
+	       div_u64((u64)level * sim.latency_per_level_ns, NSEC_PER_USEC));
+
+	if (sim.fail_percent && get_random_u32() % 100 < sim.fail_percent) {
+		sim.failures++;
+		status = AE_ERROR;
+		goto out;
+	}
+
+	if (id == WMI_BRIGHTNESS_METHOD_SOURCE) {
+		if (args->mode == WMI_BRIGHTNESS_MODE_GET)
+			args->ret = sim.source;
+		else if (args->mode == WMI_BRIGHTNESS_MODE_SET)
+			sim.source = args->val;
+		else
+			status = AE_BAD_PARAMETER;
+		goto out;
+	}
+
+	switch (args->mode) {
+	case WMI_BRIGHTNESS_MODE_GET:
+		args->ret = sim.level;
+		break;
+	case WMI_BRIGHTNESS_MODE_SET:
+		if (args->val > sim.max_level) {
+			status = AE_BAD_PARAMETER;
+			break;
+		}
+		sim.level = rounddown(args->val, max(sim.step, 1U));
+		if (!sim.gpu_owns_panel)
+			sim.panel_level = sim.level;
+		break;
+	case WMI_BRIGHTNESS_MODE_GET_MAX_LEVEL:
+		args->ret = sim.max_level;
+		break;
+	default:
+		status = AE_BAD_PARAMETER;
+	}
+
+out:
+	mutex_unlock(&sim.lock);
+
+	return status;
+}
+
+/* Called first thing on resume, so that the firmware's reset is seen. */
+static void wmi_brightness_sim_resume(void)
+{
+	mutex_lock(&sim.lock);
+	if (sim.reset_on_resume) {
+		sim.level = sim.max_level;
+		if (!sim.gpu_owns_panel)
+			sim.panel_level = sim.level;
+	}
+	mutex_unlock(&sim.lock);
+}
+
+static void wmi_brightness_sim_register(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct dentry *dir = debugfs_create_dir("sim", priv->debugfs);
+
+	debugfs_create_u32("source", 0644, dir, &sim.source);
+	debugfs_create_u32("level", 0644, dir, &sim.level);
+	debugfs_create_u32("max_level", 0644, dir, &sim.max_level);
+	debugfs_create_u32("panel_level", 0444, dir, &sim.panel_level);
+	debugfs_create_u32("step", 0644, dir, &sim.step);
+	debugfs_create_u32("fail_percent", 0644, dir, &sim.fail_percent);
+	debugfs_create_u32("latency_us", 0644, dir, &sim.latency_us);
+	debugfs_create_u32("latency_per_level_ns", 0644, dir,
+			   &sim.latency_per_level_ns);
+	debugfs_create_bool("reset_on_resume", 0644, dir, &sim.reset_on_resume);
+	debugfs_create_bool("gpu_owns_panel", 0644, dir, &sim.gpu_owns_panel);
+	debugfs_create_u64("calls", 0444, dir, &sim.calls);
+	debugfs_create_u64("failures", 0444, dir, &sim.failures);
+}
+
+#else
+
+static acpi_status wmi_brightness_sim_evaluate(u32 id, struct wmi_brightness_args *args)
+{
+	return AE_NOT_IMPLEMENTED;
+}
+
+static void wmi_brightness_sim_resume(void) { }
+static void wmi_brightness_sim_register(struct nvidia_wmi_ec_backlight_priv *priv) { }
+
+#endif /* CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM */
+
+/**
+ * struct nvidia_wmi_ec_backlight_shm - brightness state shared with userspace
+ * @kref:  held by the driver and by each open file
+ * @misc:  the character device
+ * @name:  name of @misc, after the WMI device
+ * @page:  page holding @state, mapped read-only into userspace
+ * @state: the &struct nvidia_wmi_ec_backlight_state in @page
+ * @lock:  serializes updates of @state
+ * @wait:  woken whenever @state changes
+ */
+struct nvidia_wmi_ec_backlight_shm {
+	struct kref kref;
+	struct miscdevice misc;
+	char *name;
+	struct page *page;
+	struct nvidia_wmi_ec_backlight_state *state;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+};
+
+/**
+ * struct nvidia_wmi_ec_backlight_shm_file - an open state device file
+ * @shm: the shared state
+ * @seq: state sequence number last seen by read() or poll()
+ */
+struct nvidia_wmi_ec_backlight_shm_file {
+	struct nvidia_wmi_ec_backlight_shm *shm;
+	u32 seq;
+};
+
+static void shm_release(struct kref *kref)
+{
+	struct nvidia_wmi_ec_backlight_shm *shm =
+		container_of(kref, struct nvidia_wmi_ec_backlight_shm, kref);
+
+	__free_page(shm->page);
+	kfree(shm->name);
+	kfree(shm);
+}
+
+/* Copy the current levels into the state page and wake up pollers. */
+static void shm_publish(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct nvidia_wmi_ec_backlight_shm *shm = priv->shm;
+	struct nvidia_wmi_ec_backlight_state *state;
+
+	if (!shm || !priv->bl_dev)
+		return;
+
+	state = shm->state;
+
+	spin_lock(&shm->lock);
+	WRITE_ONCE(state->seq, state->seq + 1);
+	smp_wmb();
+	WRITE_ONCE(state->level, READ_ONCE(priv->bl_dev->props.brightness));
+	WRITE_ONCE(state->max_level, priv->bl_dev->props.max_brightness);
+	WRITE_ONCE(state->ec_level, READ_ONCE(priv->ec_level));
+	smp_wmb();
+	WRITE_ONCE(state->seq, state->seq + 1);
+	spin_unlock(&shm->lock);
+
+	wake_up_interruptible(&shm->wait);
+}
+
+static int shm_open(struct inode *inode, struct file *file)
+{
+	struct nvidia_wmi_ec_backlight_shm *shm =
+		container_of(file->private_data, struct nvidia_wmi_ec_backlight_shm, misc);
+	struct nvidia_wmi_ec_backlight_shm_file *f;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	/* misc_open() holds misc_mtx, so this can't race with deregistration */
+	kref_get(&shm->kref);
+	f->shm = shm;
+	f->seq = READ_ONCE(shm->state->seq);
+	file->private_data = f;
+
+	return stream_open(inode, file);
+}
+
+static int shm_file_release(struct inode *inode, struct file *file)
+{
+	struct nvidia_wmi_ec_backlight_shm_file *f = file->private_data;
+
+	kref_put(&f->shm->kref, shm_release);
+	kfree(f);
+
+	return 0;
+}
+
+static ssize_t shm_read(struct file *file, char __user *buf, size_t count,
+			loff_t *ppos)
+{
+	struct nvidia_wmi_ec_backlight_shm_file *f = file->private_data;
+	struct nvidia_wmi_ec_backlight_shm *shm = f->shm;
+	struct nvidia_wmi_ec_backlight_state state;
+
+	if (count < sizeof(state))
+		return -EINVAL;
+
+	spin_lock(&shm->lock);
+	state = *shm->state;
+	spin_unlock(&shm->lock);
+
+	if (copy_to_user(buf, &state, sizeof(state)))
+		return -EFAULT;
+
+	WRITE_ONCE(f->seq, state.seq);
+
+	return sizeof(state);
+}
+
+static __poll_t shm_poll(struct file *file, poll_table *wait)
+{
+	struct nvidia_wmi_ec_backlight_shm_file *f = file->private_data;
+	struct nvidia_wmi_ec_backlight_shm *shm = f->shm;
+	u32 seq;
+
+	poll_wait(file, &shm->wait, wait);
+
+	/*
+	 * Stay readable until read() has returned the change: poll() may be
+	 * called several times for one wakeup, e.g. by epoll, and must not
+	 * consume it.
+	 */
+	seq = READ_ONCE(shm->state->seq);
+	if (seq != READ_ONCE(f->seq))
+		return EPOLLIN | EPOLLRDNORM | EPOLLPRI;
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static inline void vm_flags_clear(struct vm_area_struct *vma, vm_flags_t flags)
+{
+	vma->vm_flags &= ~flags;
+}
+#endif
+
+static int shm_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct nvidia_wmi_ec_backlight_shm_file *f = file->private_data;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	return vm_insert_page(vma, vma->vm_start, f->shm->page);
+}
+
+static const struct file_operations shm_fops = {
+	.owner = THIS_MODULE,
+	.open = shm_open,
+	.release = shm_file_release,
+	.read = shm_read,
+	.poll = shm_poll,
+	.mmap = shm_mmap,
+	.llseek = noop_llseek,
+};
+
+static void shm_destroy(void *data)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = data;
+	struct nvidia_wmi_ec_backlight_shm *shm = priv->shm;
+
+	misc_deregister(&shm->misc);
+	priv->shm = NULL;
+	kref_put(&shm->kref, shm_release);
+}
+
+static int shm_create(struct wmi_device *wdev,
+		      struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct nvidia_wmi_ec_backlight_shm *shm;
+	int ret;
+
+	shm = kzalloc(sizeof(*shm), GFP_KERNEL);
+	if (!shm)
+		return -ENOMEM;
+
+	kref_init(&shm->kref);
+
+	/* One device per backlight instance, named after its WMI device. */
+	shm->name = kasprintf(GFP_KERNEL, "nvidia-wmi-ec-backlight-%s",
+			      dev_name(&wdev->dev));
+	shm->page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!shm->name || !shm->page) {
+		if (shm->page)
+			__free_page(shm->page);
+		kfree(shm->name);
+		kfree(shm);
+		return -ENOMEM;
+	}
+
+	shm->state = page_address(shm->page);
+	spin_lock_init(&shm->lock);
+	init_waitqueue_head(&shm->wait);
+
+	shm->misc.minor = MISC_DYNAMIC_MINOR;
+	shm->misc.name = shm->name;
+	shm->misc.fops = &shm_fops;
+	shm->misc.parent = &wdev->dev;
+	shm->misc.mode = 0444;
+
+	/* Not fatal: the state page is only an optimization for readers. */
+	ret = misc_register(&shm->misc);
+	if (ret) {
+		dev_warn(&wdev->dev, "Unable to register state device: %d\n", ret);
+		kref_put(&shm->kref, shm_release);
+		return 0;
+	}
+
+	priv->shm = shm;
+
+	return devm_add_action_or_reset(&wdev->dev, shm_destroy, priv);
+}
+
+/* Record a level which the EC has accepted or reported. */
+static void ec_level_confirmed(struct wmi_device *w, u32 level)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(&w->dev);
+
+	if (!priv)
+		return;
+
+	WRITE_ONCE(priv->ec_level, level);
+	shm_publish(priv);
+}
+
 /**
  * wmi_brightness_notify() - helper function for calling WMI-wrapped ACPI method
  * @w:    Pointer to the struct wmi_device identified by %WMI_BRIGHTNESS_GUID
@@ -168,6 +747,7 @@ static int wmi_brightness_notify(struct wmi_device *w, enum wmi_brightness_metho
 	};
 	struct acpi_buffer buf = { (acpi_size)sizeof(args), &args };
 	acpi_status status;
+	u64 start, duration;
 
 	if (id < WMI_BRIGHTNESS_METHOD_LEVEL ||
 	    id >= WMI_BRIGHTNESS_METHOD_MAX ||
@@ -177,7 +757,15 @@ static int wmi_brightness_notify(struct wmi_device *w, enum wmi_brightness_metho
 	if (mode == WMI_BRIGHTNESS_MODE_SET)
 		args.val = *val;
 
-	status = wmidev_evaluate_method(w, 0, id, &buf, &buf);
+	start = ktime_get_ns();
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM))
+		status = wmi_brightness_sim_evaluate(id, &args);
+	else
+		status = wmidev_evaluate_method(w, 0, id, &buf, &buf);
+	duration = ktime_get_ns() - start;
+	trace_nvidia_wmi_ec_backlight_ec_call(id, mode,
+		mode == WMI_BRIGHTNESS_MODE_SET ? args.val : args.ret,
+		ACPI_FAILURE(status) ? -EIO : 0, duration);
 	if (ACPI_FAILURE(status)) {
 		dev_err(&w->dev, "EC backlight control failed: %s\n",
 			acpi_format_exception(status));
@@ -187,159 +775,1418 @@ static int wmi_brightness_notify(struct wmi_device *w, enum wmi_brightness_metho
 	if (mode != WMI_BRIGHTNESS_MODE_SET)
 		*val = args.ret;
 
+	if (id == WMI_BRIGHTNESS_METHOD_LEVEL &&
+	    mode != WMI_BRIGHTNESS_MODE_GET_MAX_LEVEL)
+		ec_level_confirmed(w, *val);
+
 	return 0;
 }
 
-/* Scale the current brightness level of 'from' to the range of 'to'. */
-static int scale_backlight_level(const struct backlight_device *from,
-				 const struct backlight_device *to)
+static int nvidia_wmi_ec_backlight_engine_get(void *data, u32 *level)
 {
-	int from_max = from->props.max_brightness;
-	int from_level = from->props.brightness;
-	int to_max = to->props.max_brightness;
-
-	return fixp_linear_interpolate(0, 0, from_max, to_max, from_level);
+	return wmi_brightness_notify(data, WMI_BRIGHTNESS_METHOD_LEVEL,
+				     WMI_BRIGHTNESS_MODE_GET, level);
 }
 
-static int nvidia_wmi_ec_backlight_update_status(struct backlight_device *bd)
+static int nvidia_wmi_ec_backlight_engine_set(void *data, u32 level)
 {
-	struct wmi_device *wdev = bl_get_data(bd);
-	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(&wdev->dev);
-	struct backlight_device *proxy_target = priv->proxy_target;
-
-	if (proxy_target) {
-		int level = scale_backlight_level(bd, proxy_target);
-
-		if (backlight_device_set_brightness(proxy_target, level))
-			pr_warn("Failed to relay backlight update to \"%s\"",
-				backlight_proxy_target);
-	}
+	return wmi_brightness_notify(data, WMI_BRIGHTNESS_METHOD_LEVEL,
+				     WMI_BRIGHTNESS_MODE_SET, &level);
+}
 
-	return wmi_brightness_notify(wdev, WMI_BRIGHTNESS_METHOD_LEVEL,
-	                             WMI_BRIGHTNESS_MODE_SET,
-			             &bd->props.brightness);
+static int nvidia_wmi_ec_backlight_engine_get_max(void *data, u32 *max_level)
+{
+	return wmi_brightness_notify(data, WMI_BRIGHTNESS_METHOD_LEVEL,
+				     WMI_BRIGHTNESS_MODE_GET_MAX_LEVEL, max_level);
 }
 
-static int nvidia_wmi_ec_backlight_get_brightness(struct backlight_device *bd)
+static const struct ec_backlight_engine_ops nvidia_wmi_ec_backlight_engine_ops = {
+	.get = nvidia_wmi_ec_backlight_engine_get,
+	.set = nvidia_wmi_ec_backlight_engine_set,
+	.get_max = nvidia_wmi_ec_backlight_engine_get_max,
+};
+
+static int nvidia_wmi_ec_backlight_ec_worker_show(struct seq_file *m, void *unused)
 {
-	struct wmi_device *wdev = bl_get_data(bd);
-	u32 level;
-	int ret;
+	struct nvidia_wmi_ec_backlight_priv *priv = m->private;
 
-	ret = wmi_brightness_notify(wdev, WMI_BRIGHTNESS_METHOD_LEVEL,
-	                            WMI_BRIGHTNESS_MODE_GET, &level);
-	if (ret < 0)
-		return ret;
+	ec_backlight_engine_show_stats(priv->engine, m);
 
-	return level;
+	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(nvidia_wmi_ec_backlight_ec_worker);
 
-static const struct backlight_ops nvidia_wmi_ec_backlight_ops = {
-	.update_status = nvidia_wmi_ec_backlight_update_status,
-	.get_brightness = nvidia_wmi_ec_backlight_get_brightness,
+static const char * const ec_worker_policies[] = {
+	[SCHED_NORMAL] = "normal",
+	[SCHED_FIFO] = "fifo",
+	[SCHED_RR] = "rr",
 };
 
-static int nvidia_wmi_ec_backlight_pm_notifier(struct notifier_block *nb, unsigned long event, void *d)
+static ssize_t ec_worker_policy_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
 {
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
 
-	/*
-	 * On some systems, the EC backlight level gets reset to 100% when
-	 * resuming from suspend, but the backlight device state still reflects
-	 * the pre-suspend value. Refresh the existing state to sync the EC's
-	 * state back up with the kernel's.
-	 */
-	if (event == PM_POST_SUSPEND) {
-		struct nvidia_wmi_ec_backlight_priv *p;
-		int ret;
+	return sysfs_emit(buf, "%s\n",
+			  ec_worker_policies[ec_backlight_engine_policy(priv->engine)]);
+}
 
-		p = container_of(nb, struct nvidia_wmi_ec_backlight_priv, nb);
-		ret = backlight_update_status(p->bl_dev);
+static ssize_t ec_worker_policy_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
+	int policy, ret;
 
-		if (ret)
-			pr_warn("failed to refresh backlight level: %d", ret);
+	policy = sysfs_match_string(ec_worker_policies, buf);
+	if (policy < 0)
+		return policy;
 
-		return NOTIFY_OK;
-	}
+	ret = ec_backlight_engine_set_policy(priv->engine, policy);
 
-	return NOTIFY_DONE;
+	return ret ? ret : count;
 }
+static DEVICE_ATTR_RW(ec_worker_policy);
 
-static void putdev(void *data)
+static ssize_t ec_worker_priority_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
 {
-	struct device *dev = data;
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
 
-	put_device(dev);
+	return sysfs_emit(buf, "%d\n", ec_backlight_engine_priority(priv->engine));
 }
 
-static int nvidia_wmi_ec_backlight_probe(struct wmi_device *wdev, const void *ctx)
+static ssize_t ec_worker_priority_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
 {
-	struct backlight_device *bdev, *target = NULL;
-	struct nvidia_wmi_ec_backlight_priv *priv;
-	struct backlight_properties props = {};
-	u32 source;
-	int ret;
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
+	int priority, ret;
 
-	/*
-	 * Check quirks tables to see if this system needs any of the firmware
-	 * bug workarounds.
-	 */
-	dmi_check_system(quirks_table);
-
-	if (backlight_proxy_target && backlight_proxy_target[0]) {
-		static int num_reprobe_attempts;
+	ret = kstrtoint(buf, 0, &priority);
+	if (ret)
+		return ret;
 
-		target = backlight_device_get_by_name(backlight_proxy_target);
+	ret = ec_backlight_engine_set_priority(priv->engine, priority);
 
-		if (target) {
-			ret = devm_add_action_or_reset(&wdev->dev, putdev,
-						       &target->dev);
-			if (ret)
-				return ret;
-		} else {
-			/*
-			 * The target backlight device might not be ready;
-			 * try again and disable backlight proxying if it
-			 * fails too many times.
-			 */
-			if (num_reprobe_attempts < max_reprobe_attempts) {
-				num_reprobe_attempts++;
-				return -EPROBE_DEFER;
-			}
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(ec_worker_priority);
 
-			pr_warn("Unable to acquire %s after %d attempts. Disabling backlight proxy.",
-				backlight_proxy_target, max_reprobe_attempts);
-		}
-	}
+static ssize_t ec_worker_cpus_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
+	cpumask_var_t cpus;
+	ssize_t ret;
 
-	ret = wmi_brightness_notify(wdev, WMI_BRIGHTNESS_METHOD_SOURCE,
-	                           WMI_BRIGHTNESS_MODE_GET, &source);
-	if (ret)
-		return ret;
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
 
-	/*
-	 * This driver is only to be used when brightness control is handled
-	 * by the EC; otherwise, the GPU driver(s) should control brightness.
-	 */
-	if (source != WMI_BRIGHTNESS_SOURCE_EC)
-		return -ENODEV;
+	ec_backlight_engine_cpus(priv->engine, cpus);
+	ret = sysfs_emit(buf, "%*pbl\n", cpumask_pr_args(cpus));
 
-	/*
-	 * Identify this backlight device as a firmware device so that it can
-	 * be prioritized over any exposed GPU-driven raw device(s).
-	 */
-	props.type = BACKLIGHT_FIRMWARE;
+	free_cpumask_var(cpus);
 
-	ret = wmi_brightness_notify(wdev, WMI_BRIGHTNESS_METHOD_LEVEL,
-	                           WMI_BRIGHTNESS_MODE_GET_MAX_LEVEL,
-	                           &props.max_brightness);
-	if (ret)
-		return ret;
+	return ret;
+}
 
-	ret = wmi_brightness_notify(wdev, WMI_BRIGHTNESS_METHOD_LEVEL,
-	                           WMI_BRIGHTNESS_MODE_GET, &props.brightness);
+static ssize_t ec_worker_cpus_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
+	cpumask_var_t cpus;
+	int ret;
+
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(buf, cpus);
+	if (!ret)
+		ret = ec_backlight_engine_set_cpus(priv->engine, cpus);
+
+	free_cpumask_var(cpus);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(ec_worker_cpus);
+
+static struct attribute *nvidia_wmi_ec_backlight_attrs[] = {
+	&dev_attr_ec_worker_policy.attr,
+	&dev_attr_ec_worker_priority.attr,
+	&dev_attr_ec_worker_cpus.attr,
+	NULL
+};
+
+static umode_t nvidia_wmi_ec_backlight_attr_is_visible(struct kobject *kobj,
+						      struct attribute *attr,
+						      int n)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		dev_get_drvdata(kobj_to_dev(kobj));
+
+	return priv && ec_backlight_engine_has_worker(priv->engine) ?
+	       attr->mode : 0;
+}
+
+static const struct attribute_group nvidia_wmi_ec_backlight_group = {
+	.attrs = nvidia_wmi_ec_backlight_attrs,
+	.is_visible = nvidia_wmi_ec_backlight_attr_is_visible,
+};
+__ATTRIBUTE_GROUPS(nvidia_wmi_ec_backlight);
+
+/**
+ * struct nvidia_wmi_ec_backlight_anim - keyframe animation device
+ * @kref:  held by the driver and by the open file
+ * @misc:  the character device
+ * @name:  name of @misc, after the WMI device
+ * @lock:  protects @priv, @ring, @page and @busy
+ * @priv:  driver private data; NULL once the driver is being removed
+ * @page:  page holding @ring, allocated for each open
+ * @ring:  the &struct nvidia_wmi_ec_backlight_ring in @page
+ * @busy:  the device is open
+ * @timer: fires when the next keyframe is due to be written
+ * @work:  consumes due keyframes
+ * @wait:  woken whenever keyframes have been consumed
+ */
+struct nvidia_wmi_ec_backlight_anim {
+	struct kref kref;
+	struct miscdevice misc;
+	char *name;
+	struct mutex lock;
+	struct nvidia_wmi_ec_backlight_priv *priv;
+	struct page *page;
+	struct nvidia_wmi_ec_backlight_ring *ring;
+	bool busy;
+	struct hrtimer timer;
+	struct work_struct work;
+	wait_queue_head_t wait;
+};
+
+#define RING_MASK (NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES - 1)
+
+static void anim_release(struct kref *kref)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim =
+		container_of(kref, struct nvidia_wmi_ec_backlight_anim, kref);
+
+	kfree(anim->name);
+	kfree(anim);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
+static enum hrtimer_restart anim_timer_fn(struct hrtimer *timer)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim =
+		container_of(timer, struct nvidia_wmi_ec_backlight_anim, timer);
+
+	/* Freezable, so that no keyframe reaches the EC while suspended. */
+	queue_work(system_freezable_wq, &anim->work);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Consume every keyframe which is due, i.e. whose EC write has to be issued
+ * now to complete by its deadline, given how long EC writes have been
+ * taking. Of several due keyframes only the last one is written.
+ */
+static void anim_work_fn(struct work_struct *work)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim =
+		container_of(work, struct nvidia_wmi_ec_backlight_anim, work);
+	struct nvidia_wmi_ec_backlight_ring *ring;
+	struct nvidia_wmi_ec_backlight_priv *priv;
+	u64 now, lead, slack = (u64)READ_ONCE(anim_slack_us) * NSEC_PER_USEC;
+	u32 head, tail;
+	int level = -1;
+
+	mutex_lock(&anim->lock);
+
+	priv = anim->priv;
+	ring = anim->ring;
+	if (!priv || !ring)
+		goto out;
+
+	lead = ec_backlight_engine_set_latency(priv->engine);
+	now = ktime_get_ns();
+	head = smp_load_acquire(&ring->head);
+	tail = ring->tail;
+
+	/* Don't trust a head which claims more than a full ring. */
+	if (head - tail > NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES)
+		head = tail + NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES;
+
+	while (tail != head) {
+		struct nvidia_wmi_ec_backlight_keyframe *kf = &ring->frames[tail & RING_MASK];
+		u64 deadline = READ_ONCE(kf->deadline_ns);
+		bool last = tail + 1 == head;
+		u32 status;
+
+		if (deadline > now + lead)
+			break;
+
+		if (!last && READ_ONCE(ring->frames[(tail + 1) & RING_MASK].deadline_ns) <= now + lead) {
+			status = NVIDIA_WMI_EC_BACKLIGHT_KF_SKIPPED;
+			ring->skipped++;
+		} else if (now + lead > deadline + slack) {
+			status = NVIDIA_WMI_EC_BACKLIGHT_KF_MISSED;
+			ring->missed++;
+			if (last)
+				level = READ_ONCE(kf->level);
+		} else {
+			status = NVIDIA_WMI_EC_BACKLIGHT_KF_DONE;
+			ring->done++;
+			level = READ_ONCE(kf->level);
+		}
+
+		WRITE_ONCE(kf->status, status);
+		tail++;
+	}
+
+	smp_store_release(&ring->tail, tail);
+
+	if (level >= 0) {
+		struct backlight_device *bd = priv->bl_dev;
+
+		if (backlight_device_set_brightness(bd, min(level, bd->props.max_brightness)))
+			pr_warn("Failed to apply animation keyframe level %d", level);
+	}
+
+	if (tail != head) {
+		u64 deadline = READ_ONCE(ring->frames[tail & RING_MASK].deadline_ns);
+
+		hrtimer_start(&anim->timer, ns_to_ktime(deadline - min(deadline, lead)),
+			      HRTIMER_MODE_ABS);
+	}
+
+	wake_up_interruptible(&anim->wait);
+out:
+	mutex_unlock(&anim->lock);
+}
+
+static int anim_open(struct inode *inode, struct file *file)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim =
+		container_of(file->private_data, struct nvidia_wmi_ec_backlight_anim, misc);
+	struct page *page;
+	int ret = 0;
+
+	page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&anim->lock);
+	if (!anim->priv) {
+		ret = -ENODEV;
+	} else if (anim->busy) {
+		ret = -EBUSY;
+	} else {
+		anim->busy = true;
+		anim->page = page;
+		anim->ring = page_address(page);
+		/* misc_open() holds misc_mtx, so this can't race with deregistration */
+		kref_get(&anim->kref);
+		file->private_data = anim;
+	}
+	mutex_unlock(&anim->lock);
+
+	if (ret) {
+		__free_page(page);
+		return ret;
+	}
+
+	return stream_open(inode, file);
+}
+
+static int anim_file_release(struct inode *inode, struct file *file)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim = file->private_data;
+	struct page *page;
+
+	mutex_lock(&anim->lock);
+	page = anim->page;
+	anim->page = NULL;
+	anim->ring = NULL;
+	mutex_unlock(&anim->lock);
+
+	hrtimer_cancel(&anim->timer);
+	cancel_work_sync(&anim->work);
+
+	/* Userspace mappings hold their own reference to the page. */
+	__free_page(page);
+
+	mutex_lock(&anim->lock);
+	anim->busy = false;
+	mutex_unlock(&anim->lock);
+
+	kref_put(&anim->kref, anim_release);
+
+	return 0;
+}
+
+static __poll_t anim_poll(struct file *file, poll_table *wait)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim = file->private_data;
+	struct nvidia_wmi_ec_backlight_ring *ring = anim->ring;
+	__poll_t mask = 0;
+	u32 head, tail;
+
+	poll_wait(file, &anim->wait, wait);
+
+	head = READ_ONCE(ring->head);
+	tail = smp_load_acquire(&ring->tail);
+
+	if (head - tail < NVIDIA_WMI_EC_BACKLIGHT_RING_FRAMES)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	if (head == tail)
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	return mask;
+}
+
+static long anim_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim = file->private_data;
+
+	switch (cmd) {
+	case NVIDIA_WMI_EC_BACKLIGHT_IOC_KICK:
+		queue_work(system_freezable_wq, &anim->work);
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int anim_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim = file->private_data;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	return vm_insert_page(vma, vma->vm_start, anim->page);
+}
+
+static const struct file_operations anim_fops = {
+	.owner = THIS_MODULE,
+	.open = anim_open,
+	.release = anim_file_release,
+	.poll = anim_poll,
+	.unlocked_ioctl = anim_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap = anim_mmap,
+	.llseek = noop_llseek,
+};
+
+/* Stop consuming keyframes; called on remove, before the backlight goes. */
+static void anim_stop(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim = priv->anim;
+
+	if (!anim)
+		return;
+
+	mutex_lock(&anim->lock);
+	anim->priv = NULL;
+	mutex_unlock(&anim->lock);
+
+	hrtimer_cancel(&anim->timer);
+	cancel_work_sync(&anim->work);
+}
+
+static void anim_destroy(void *data)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = data;
+	struct nvidia_wmi_ec_backlight_anim *anim = priv->anim;
+
+	anim_stop(priv);
+	misc_deregister(&anim->misc);
+	priv->anim = NULL;
+	kref_put(&anim->kref, anim_release);
+}
+
+static int anim_create(struct wmi_device *wdev,
+		       struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct nvidia_wmi_ec_backlight_anim *anim;
+	int ret;
+
+	anim = kzalloc(sizeof(*anim), GFP_KERNEL);
+	if (!anim)
+		return -ENOMEM;
+
+	anim->name = kasprintf(GFP_KERNEL, "nvidia-wmi-ec-backlight-anim-%s",
+			       dev_name(&wdev->dev));
+	if (!anim->name) {
+		kfree(anim);
+		return -ENOMEM;
+	}
+
+	kref_init(&anim->kref);
+	mutex_init(&anim->lock);
+	anim->priv = priv;
+	hrtimer_setup(&anim->timer, anim_timer_fn, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS);
+	INIT_WORK(&anim->work, anim_work_fn);
+	init_waitqueue_head(&anim->wait);
+
+	anim->misc.minor = MISC_DYNAMIC_MINOR;
+	anim->misc.name = anim->name;
+	anim->misc.fops = &anim_fops;
+	anim->misc.parent = &wdev->dev;
+	anim->misc.mode = 0600;
+
+	/* Not fatal: animations can still be driven through sysfs. */
+	ret = misc_register(&anim->misc);
+	if (ret) {
+		dev_warn(&wdev->dev, "Unable to register animation device: %d\n", ret);
+		kref_put(&anim->kref, anim_release);
+		return 0;
+	}
+
+	priv->anim = anim;
+
+	return devm_add_action_or_reset(&wdev->dev, anim_destroy, priv);
+}
+
+/* Scale the current brightness level of 'from' to the range of 'to'. */
+static int scale_backlight_level(const struct backlight_device *from,
+				 const struct backlight_device *to)
+{
+	int from_max = from->props.max_brightness;
+	int from_level = from->props.brightness;
+	int to_max = to->props.max_brightness;
+
+	return fixp_linear_interpolate(0, 0, from_max, to_max, from_level);
+}
+
+/* Limit level to the cap of the current thermal cooling state. */
+static int thermal_cap_level(struct nvidia_wmi_ec_backlight_priv *priv, int level)
+{
+	int max = priv->bl_dev->props.max_brightness;
+	int floor = max * min(thermal_min_percent, 100U) / 100;
+	unsigned long state = READ_ONCE(priv->cap_state);
+
+	if (!thermal_states || !state)
+		return level;
+
+	return min(level, max - (int)(state * (max - floor) / thermal_states));
+}
+
+/*
+ * Write level to the EC, unless it is the level most recently written there
+ * and force is not set. Called with the backlight's ops_lock held.
+ */
+static int ec_write_level(struct nvidia_wmi_ec_backlight_priv *priv, u32 level,
+			  bool force)
+{
+	lockdep_assert_held(&priv->bl_dev->ops_lock);
+
+	return ec_backlight_engine_set(priv->engine, level,
+				       force ? EC_BACKLIGHT_ENGINE_SET_FORCE : 0);
+}
+
+/* Relay and apply bd's current level. Called with bd->ops_lock held. */
+static int nvidia_wmi_ec_backlight_set_level(struct backlight_device *bd,
+					     enum nvidia_wmi_ec_backlight_source source)
+{
+	struct wmi_device *wdev = bl_get_data(bd);
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(&wdev->dev);
+	struct backlight_device *proxy_target = READ_ONCE(priv->proxy_target);
+	int level = thermal_cap_level(priv, bd->props.brightness);
+
+	lockdep_assert_held(&bd->ops_lock);
+
+	trace_nvidia_wmi_ec_backlight_request(source, bd->props.brightness);
+	shm_publish(priv);
+
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_PROXY) && proxy_target) {
+		int target_level = fixp_linear_interpolate(0, 0,
+				bd->props.max_brightness,
+				proxy_target->props.max_brightness, level);
+
+		atomic_set(&priv->relay_level, target_level);
+		if (backlight_device_set_brightness(proxy_target, target_level))
+			pr_warn("Failed to relay backlight update to \"%s\"",
+				backlight_proxy_target);
+		atomic_set(&priv->relay_level, -1);
+	}
+
+	return ec_write_level(priv, level, false);
+}
+
+static int nvidia_wmi_ec_backlight_update_status(struct backlight_device *bd)
+{
+	return nvidia_wmi_ec_backlight_set_level(bd,
+						 NVIDIA_WMI_EC_BACKLIGHT_SRC_UPDATE);
+}
+
+static int nvidia_wmi_ec_backlight_get_brightness(struct backlight_device *bd)
+{
+	struct wmi_device *wdev = bl_get_data(bd);
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(&wdev->dev);
+	u32 level;
+	int ret;
+
+	ret = ec_backlight_engine_get(priv->engine, &level);
+	if (ret < 0)
+		return ret;
+
+	return level;
+}
+
+static const struct backlight_ops nvidia_wmi_ec_backlight_ops = {
+	.update_status = nvidia_wmi_ec_backlight_update_status,
+	.get_brightness = nvidia_wmi_ec_backlight_get_brightness,
+};
+
+static const char * const phase_names[NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX] = {
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_QUIRKS] = "quirks",
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_PROXY_LOOKUP] = "proxy_lookup",
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_SOURCE] = "source",
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX_LEVEL] = "max_level",
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_LEVEL] = "level",
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_REGISTER] = "register",
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_IMPORT] = "import",
+	[NVIDIA_WMI_EC_BACKLIGHT_PHASE_RESUME] = "resume",
+};
+
+/* Record the time since *start as the duration of phase, and restart *start. */
+static void timing_phase_end(struct nvidia_wmi_ec_backlight_priv *priv,
+			     enum nvidia_wmi_ec_backlight_phase phase, u64 *start)
+{
+	u64 now;
+
+	if (!IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_STATS) &&
+	    !IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_TRACE))
+		return;
+
+	now = ktime_get_ns();
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_STATS))
+		priv->timing.phase_ns[phase] = now - *start;
+	trace_nvidia_wmi_ec_backlight_phase(phase, now - *start);
+	*start = now;
+}
+
+static int nvidia_wmi_ec_backlight_timings_show(struct seq_file *m, void *unused)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = m->private;
+	struct nvidia_wmi_ec_backlight_timing *timing = &priv->timing;
+	int i;
+
+	for (i = 0; i < NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX; i++)
+		seq_printf(m, "%s_ns: %llu\n", phase_names[i], timing->phase_ns[i]);
+
+	seq_printf(m, "probe_ns: %llu\n", timing->probe_ns);
+	seq_printf(m, "defer_count: %d\n", timing->defer_count);
+	seq_printf(m, "defer_wait_ns: %llu\n", timing->defer_wait_ns);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(nvidia_wmi_ec_backlight_timings);
+
+/*
+ * Sample the EC level and re-apply the requested level if the EC changed it
+ * on its own. What the EC reports right after the re-application is taken as
+ * its rendering of that level, so that firmware which quantizes levels isn't
+ * found drifting on every sample. The interval doubles, up to
+ * drift_max_interval_ms, for as long as the level is found unchanged or the
+ * re-application doesn't stick, and drops back to drift_min_interval_ms when
+ * drift was found and corrected.
+ */
+static void drift_work_fn(struct work_struct *work)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		container_of(to_delayed_work(work),
+			     struct nvidia_wmi_ec_backlight_priv, drift_work);
+	struct backlight_device *bd = priv->bl_dev;
+	unsigned int interval = READ_ONCE(priv->drift_interval_ms);
+	bool fixed = false;
+	int requested, ret;
+	u32 level;
+
+	mutex_lock(&bd->ops_lock);
+
+	/* A level still queued on the EC worker would look like drift. */
+	if (bd->ops && !ec_backlight_engine_set_pending(priv->engine)) {
+		requested = thermal_cap_level(priv, bd->props.brightness);
+		priv->drift_checks++;
+		ret = ec_backlight_engine_get(priv->engine, &level);
+		if (!ret && (int)level != requested &&
+		    (requested != priv->drift_level || level != priv->drift_ec_level)) {
+			priv->drift_fixes++;
+			trace_nvidia_wmi_ec_backlight_request(NVIDIA_WMI_EC_BACKLIGHT_SRC_DRIFT,
+							      requested);
+			ret = ec_write_level(priv, requested, true);
+			if (!ret)
+				ret = ec_backlight_engine_get(priv->engine, &level);
+			if (ret) {
+				pr_warn("Failed to re-apply drifted backlight level: %d",
+					ret);
+			} else {
+				priv->drift_level = requested;
+				priv->drift_ec_level = level;
+				fixed = (int)level == requested;
+			}
+		}
+
+		/*
+		 * The EC holds the requested level, as rendered by it: keep
+		 * the read-backs from invalidating the shadow level.
+		 */
+		if (!ret)
+			ec_backlight_engine_set_shadow(priv->engine, requested);
+	}
+
+	mutex_unlock(&bd->ops_lock);
+
+	if (fixed)
+		interval = drift_min_interval_ms;
+	else
+		interval = min(interval * 2, drift_max_interval_ms);
+	interval = max(interval, 1U);
+	WRITE_ONCE(priv->drift_interval_ms, interval);
+
+	queue_delayed_work(system_freezable_power_efficient_wq, &priv->drift_work,
+			   msecs_to_jiffies(interval));
+}
+
+/* Check soon and often again, after an event which may have moved the level. */
+static void drift_kick(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	unsigned int interval = max(drift_min_interval_ms, 1U);
+
+	WRITE_ONCE(priv->drift_interval_ms, interval);
+	mod_delayed_work(system_freezable_power_efficient_wq, &priv->drift_work,
+			 msecs_to_jiffies(interval));
+}
+
+static int drift_psy_notifier(struct notifier_block *nb, unsigned long event,
+			      void *data)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		container_of(nb, struct nvidia_wmi_ec_backlight_priv, psy_nb);
+	struct power_supply *psy = data;
+
+	if (event != PSY_EVENT_PROP_CHANGED)
+		return NOTIFY_DONE;
+
+	/* AC adapters, and USB-C docks which charge through a USB supply. */
+	switch (psy->desc->type) {
+	case POWER_SUPPLY_TYPE_MAINS:
+	case POWER_SUPPLY_TYPE_USB:
+		drift_kick(priv);
+		return NOTIFY_OK;
+	default:
+		return NOTIFY_DONE;
+	}
+}
+
+static int drift_lid_notifier(struct notifier_block *nb, unsigned long event,
+			      void *data)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		container_of(nb, struct nvidia_wmi_ec_backlight_priv, lid_nb);
+
+	drift_kick(priv);
+
+	return NOTIFY_OK;
+}
+
+static void drift_start(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	INIT_DELAYED_WORK(&priv->drift_work, drift_work_fn);
+	priv->drift_level = -1;
+
+	priv->psy_nb.notifier_call = drift_psy_notifier;
+	if (power_supply_reg_notifier(&priv->psy_nb)) {
+		dev_warn(&priv->wdev->dev, "Unable to watch power supply events\n");
+		priv->psy_nb.notifier_call = NULL;
+	}
+
+	priv->lid_nb.notifier_call = drift_lid_notifier;
+	if (acpi_lid_notifier_register(&priv->lid_nb)) {
+		dev_warn(&priv->wdev->dev, "Unable to watch lid events\n");
+		priv->lid_nb.notifier_call = NULL;
+	}
+
+	drift_kick(priv);
+}
+
+static void drift_stop(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	if (!drift_check)
+		return;
+
+	if (priv->lid_nb.notifier_call)
+		acpi_lid_notifier_unregister(&priv->lid_nb);
+	if (priv->psy_nb.notifier_call)
+		power_supply_unreg_notifier(&priv->psy_nb);
+
+	cancel_delayed_work_sync(&priv->drift_work);
+}
+
+static int nvidia_wmi_ec_backlight_drift_show(struct seq_file *m, void *unused)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = m->private;
+
+	seq_printf(m, "checks: %llu\n", priv->drift_checks);
+	seq_printf(m, "fixes: %llu\n", priv->drift_fixes);
+	seq_printf(m, "interval_ms: %u\n", READ_ONCE(priv->drift_interval_ms));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(nvidia_wmi_ec_backlight_drift);
+
+/*
+ * Let pending EC writes land before the system goes to sleep. The drift
+ * check is stopped until resume, which verifies the level on its own.
+ */
+static int nvidia_wmi_ec_backlight_suspend_late(struct device *dev)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
+
+	if (drift_check)
+		cancel_delayed_work_sync(&priv->drift_work);
+
+	ec_backlight_engine_flush(priv->engine);
+
+	return 0;
+}
+
+/*
+ * On some systems, the EC backlight level gets reset to 100% when resuming
+ * from any sleep state, but the backlight device state still reflects the
+ * pre-suspend value. Write the requested level straight back to the EC,
+ * early in resume and before userspace is thawed, bypassing the EC worker.
+ * The proxy target restores its own level in its resume callback, which runs
+ * after every resume_early; the EC write doesn't depend on it.
+ */
+static int nvidia_wmi_ec_backlight_resume_early(struct device *dev)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(dev);
+	struct backlight_device *bd = priv->bl_dev;
+	u64 start = ktime_get_ns();
+	int level, ret;
+
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM))
+		wmi_brightness_sim_resume();
+
+	/* Runs once tasks are thawed; the EC may still settle after resume. */
+	if (drift_check)
+		drift_kick(priv);
+
+	if (!restore_level_on_resume)
+		return 0;
+
+	mutex_lock(&bd->ops_lock);
+	level = thermal_cap_level(priv, bd->props.brightness);
+
+	trace_nvidia_wmi_ec_backlight_request(NVIDIA_WMI_EC_BACKLIGHT_SRC_RESUME,
+					      level);
+	ret = ec_backlight_engine_set(priv->engine, level,
+				      EC_BACKLIGHT_ENGINE_SET_FORCE |
+				      EC_BACKLIGHT_ENGINE_SET_DIRECT);
+	mutex_unlock(&bd->ops_lock);
+
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_RESUME, &start);
+
+	/* Not worth failing resume over; the next update retries. */
+	if (ret)
+		dev_warn(dev, "Failed to restore backlight level: %d\n", ret);
+
+	return 0;
+}
+
+static const struct dev_pm_ops nvidia_wmi_ec_backlight_pm_ops = {
+	SET_LATE_SYSTEM_SLEEP_PM_OPS(nvidia_wmi_ec_backlight_suspend_late,
+				     nvidia_wmi_ec_backlight_resume_early)
+};
+
+static void nvidia_wmi_ec_backlight_mirror_work(struct work_struct *work)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		container_of(work, struct nvidia_wmi_ec_backlight_priv, mirror_work);
+	struct backlight_device *target = READ_ONCE(priv->proxy_target);
+	struct backlight_device *bd = priv->bl_dev;
+	bool changed = false;
+	int level, ret = 0;
+
+	if (!target)
+		return;
+
+	/*
+	 * Sample the target's latest level under our ops_lock, nesting the
+	 * target's in it like the relay does, so that a relay can't slip in
+	 * between and be overwritten by the stale sample.
+	 */
+	mutex_lock(&bd->ops_lock);
+	mutex_lock(&target->ops_lock);
+	level = scale_backlight_level(target, bd);
+	mutex_unlock(&target->ops_lock);
+
+	/*
+	 * Write the EC directly instead of going through update_status, so
+	 * that the mirrored level does not get relayed back to the target.
+	 */
+	if (bd->ops && level != bd->props.brightness) {
+		bd->props.brightness = level;
+		trace_nvidia_wmi_ec_backlight_request(
+			NVIDIA_WMI_EC_BACKLIGHT_SRC_MIRROR, level);
+		ret = ec_write_level(priv, thermal_cap_level(priv, level), false);
+		changed = !ret;
+	}
+	mutex_unlock(&bd->ops_lock);
+
+	if (ret)
+		pr_warn("Failed to mirror backlight update from \"%s\"",
+			backlight_proxy_target);
+	else if (changed)
+		sysfs_notify(&bd->dev.kobj, NULL, "brightness");
+}
+
+/*
+ * Called with the proxy target's ops_lock held. The EC update is deferred to
+ * mirror_work, as taking our own ops_lock here would invert the lock order of
+ * the relay in nvidia_wmi_ec_backlight_update_status().
+ */
+static int nvidia_wmi_ec_backlight_proxy_update_status(struct backlight_device *bd)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		container_of(bd->ops, struct nvidia_wmi_ec_backlight_priv, proxy_ops);
+	int level = bd->props.brightness;
+	int ret;
+
+	lockdep_assert_held(&bd->ops_lock);
+
+	ret = priv->proxy_orig_ops->update_status(bd);
+	if (ret)
+		return ret;
+
+	/*
+	 * Don't mirror a level which we have just relayed ourselves. The work
+	 * is freezable, so that it can't write the EC between suspend_late and
+	 * resume_early.
+	 */
+	if (atomic_cmpxchg(&priv->relay_level, level, -1) != level)
+		queue_work(system_freezable_wq, &priv->mirror_work);
+
+	return 0;
+}
+
+static void hook_proxy_target(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct backlight_device *target = priv->proxy_target;
+
+	mutex_lock(&target->ops_lock);
+	if (target->ops && target->ops->update_status) {
+		priv->proxy_ops = *target->ops;
+		priv->proxy_ops.update_status =
+			nvidia_wmi_ec_backlight_proxy_update_status;
+		priv->proxy_orig_ops = target->ops;
+		target->ops = &priv->proxy_ops;
+	}
+	mutex_unlock(&target->ops_lock);
+}
+
+static void unhook_proxy_target(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct backlight_device *target = priv->proxy_target;
+
+	if (!target)
+		return;
+
+	mutex_lock(&target->ops_lock);
+	if (target->ops == &priv->proxy_ops)
+		target->ops = priv->proxy_orig_ops;
+	priv->proxy_orig_ops = NULL;
+	mutex_unlock(&target->ops_lock);
+
+	cancel_work_sync(&priv->mirror_work);
+}
+
+static int nvidia_wmi_ec_backlight_bl_notifier(struct notifier_block *nb, unsigned long event, void *d)
+{
+	struct nvidia_wmi_ec_backlight_priv *p;
+	struct backlight_device *bd = d;
+
+	p = container_of(nb, struct nvidia_wmi_ec_backlight_priv, bl_nb);
+
+	/*
+	 * Give the proxy target back its own ops before it goes away, and stop
+	 * relaying to it.
+	 */
+	if (event == BACKLIGHT_UNREGISTERED && bd == p->proxy_target) {
+		unhook_proxy_target(p);
+		WRITE_ONCE(p->proxy_target, NULL);
+
+		return NOTIFY_OK;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static int thermal_get_max_state(struct thermal_cooling_device *cdev,
+				 unsigned long *state)
+{
+	*state = thermal_states;
+
+	return 0;
+}
+
+static int thermal_get_cur_state(struct thermal_cooling_device *cdev,
+				 unsigned long *state)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = cdev->devdata;
+
+	*state = READ_ONCE(priv->cap_state);
+
+	return 0;
+}
+
+static int thermal_set_cur_state(struct thermal_cooling_device *cdev,
+				 unsigned long state)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv = cdev->devdata;
+	struct backlight_device *bd = priv->bl_dev;
+	int ret = -ENXIO;
+
+	if (state > thermal_states)
+		return -EINVAL;
+
+	/* The EC write is elided if the capped level doesn't change. */
+	mutex_lock(&bd->ops_lock);
+	WRITE_ONCE(priv->cap_state, state);
+	if (bd->ops)
+		ret = nvidia_wmi_ec_backlight_set_level(bd,
+				NVIDIA_WMI_EC_BACKLIGHT_SRC_THERMAL);
+	mutex_unlock(&bd->ops_lock);
+
+	return ret;
+}
+
+static const struct thermal_cooling_device_ops nvidia_wmi_ec_backlight_cooling_ops = {
+	.get_max_state = thermal_get_max_state,
+	.get_cur_state = thermal_get_cur_state,
+	.set_cur_state = thermal_set_cur_state,
+};
+
+/* Key repeats after which a held brightness key steps one multiple further. */
+#define HOTKEY_ACCEL_REPEATS 5
+
+/*
+ * Apply the level change accumulated by the brightness keys, through the
+ * same path as update_status, and tell userspace about the new level the
+ * way a sysfs write would.
+ */
+static void hotkey_work_fn(struct work_struct *work)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		container_of(work, struct nvidia_wmi_ec_backlight_priv, hotkey_work);
+	struct backlight_device *bd = priv->bl_dev;
+	char *envp[] = { "SOURCE=hotkey", NULL };
+	int delta = atomic_xchg(&priv->hotkey_delta, 0);
+	bool changed = false;
+	int level, ret = 0;
+
+	if (!delta)
+		return;
+
+	mutex_lock(&bd->ops_lock);
+	if (bd->ops) {
+		level = clamp(bd->props.brightness + delta, 0,
+			      bd->props.max_brightness);
+		if (level != bd->props.brightness) {
+			bd->props.brightness = level;
+			ret = nvidia_wmi_ec_backlight_set_level(bd,
+					NVIDIA_WMI_EC_BACKLIGHT_SRC_HOTKEY);
+			changed = true;
+		}
+	}
+	mutex_unlock(&bd->ops_lock);
+
+	if (ret)
+		pr_warn("Failed to apply brightness key change: %d", ret);
+
+	if (changed) {
+		sysfs_notify(&bd->dev.kobj, NULL, "brightness");
+		sysfs_notify(&bd->dev.kobj, NULL, "actual_brightness");
+		kobject_uevent_env(&bd->dev.kobj, KOBJ_CHANGE, envp);
+	}
+}
+
+/**
+ * struct hotkey_handle - connection of the brightness key handler to a device
+ * @handle:  the input handle
+ * @repeats: number of auto-repeats of the brightness key being held on this
+ *           device; only touched by hotkey_filter(), which the input core
+ *           serializes per device
+ */
+struct hotkey_handle {
+	struct input_handle handle;
+	unsigned int repeats;
+};
+
+/*
+ * Called in atomic context for every event of a connected input device.
+ * Brightness key events are consumed here, so that userspace doesn't step
+ * the level a second time.
+ */
+static bool hotkey_filter(struct input_handle *handle, unsigned int type,
+			  unsigned int code, int value)
+{
+	struct nvidia_wmi_ec_backlight_priv *priv =
+		container_of(handle->handler, struct nvidia_wmi_ec_backlight_priv,
+			     hotkey_handler);
+	struct hotkey_handle *h = container_of(handle, struct hotkey_handle, handle);
+	int step, mult;
+
+	if (type != EV_KEY ||
+	    (code != KEY_BRIGHTNESSUP && code != KEY_BRIGHTNESSDOWN))
+		return false;
+
+	/* 0 is a release, 1 a press and 2 an auto-repeat. */
+	if (value == 0)
+		return true;
+	if (value == 1)
+		h->repeats = 0;
+	else
+		h->repeats++;
+
+	mult = min(1 + h->repeats / HOTKEY_ACCEL_REPEATS,
+		   max(READ_ONCE(hotkey_accel_max), 1U));
+	step = max(priv->bl_dev->props.max_brightness *
+		   (int)READ_ONCE(hotkey_step_percent) / 100, 1);
+
+	/* Keys pressed while suspending are applied once tasks are thawed. */
+	atomic_add(code == KEY_BRIGHTNESSUP ? step * mult : -step * mult,
+		   &priv->hotkey_delta);
+	queue_work(system_freezable_wq, &priv->hotkey_work);
+
+	return true;
+}
+
+static int hotkey_connect(struct input_handler *handler, struct input_dev *dev,
+			  const struct input_device_id *id)
+{
+	struct hotkey_handle *h;
+	struct input_handle *handle;
+	int ret;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+
+	handle = &h->handle;
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = KBUILD_MODNAME;
+
+	ret = input_register_handle(handle);
+	if (ret)
+		goto err_free;
+
+	ret = input_open_device(handle);
+	if (ret)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(h);
+	return ret;
+}
+
+static void hotkey_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(container_of(handle, struct hotkey_handle, handle));
+}
+
+static const struct input_device_id hotkey_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT | INPUT_DEVICE_ID_MATCH_KEYBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+		.keybit = { [BIT_WORD(KEY_BRIGHTNESSUP)] = BIT_MASK(KEY_BRIGHTNESSUP) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT | INPUT_DEVICE_ID_MATCH_KEYBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+		.keybit = { [BIT_WORD(KEY_BRIGHTNESSDOWN)] = BIT_MASK(KEY_BRIGHTNESSDOWN) },
+	},
+	{ }
+};
+
+static void hotkey_start(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	struct input_handler *handler = &priv->hotkey_handler;
+
+	INIT_WORK(&priv->hotkey_work, hotkey_work_fn);
+	atomic_set(&priv->hotkey_delta, 0);
+
+	handler->filter = hotkey_filter;
+	handler->connect = hotkey_connect;
+	handler->disconnect = hotkey_disconnect;
+	handler->name = KBUILD_MODNAME;
+	handler->id_table = hotkey_ids;
+
+	if (input_register_handler(handler)) {
+		dev_warn(&priv->wdev->dev, "Unable to register brightness key handler\n");
+		handler->connect = NULL;
+	}
+}
+
+static void hotkey_stop(struct nvidia_wmi_ec_backlight_priv *priv)
+{
+	if (!hotkeys || !priv->hotkey_handler.connect)
+		return;
+
+	input_unregister_handler(&priv->hotkey_handler);
+	cancel_work_sync(&priv->hotkey_work);
+}
+
+/*
+ * Find the level for this system in a list of "product=level" entries,
+ * separated by commas or newlines. An entry matching the DMI product name or
+ * version takes precedence over a bare level.
+ */
+static int saved_level_parse(const char *buf, size_t len)
+{
+	const char *name = dmi_get_system_info(DMI_PRODUCT_NAME);
+	const char *version = dmi_get_system_info(DMI_PRODUCT_VERSION);
+	char *list, *cur, *entry;
+	int level = -ENOENT;
+
+	list = kmemdup_nul(buf, len, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+
+	cur = list;
+	while ((entry = strsep(&cur, ",\n"))) {
+		char *product = NULL, *value = strrchr(entry, '=');
+		unsigned int val;
+
+		if (value) {
+			*value++ = '\0';
+			product = strim(entry);
+			if ((!name || strcmp(product, name)) &&
+			    (!version || strcmp(product, version)))
+				continue;
+		} else {
+			value = entry;
+		}
+
+		if (kstrtouint(strim(value), 10, &val) || val > INT_MAX)
+			continue;
+
+		level = val;
+		if (product)
+			break;
+	}
+
+	kfree(list);
+
+	return level;
+}
+
+/* The saved level for this system, or a negative error number if none. */
+static int saved_level_get(struct wmi_device *wdev)
+{
+	const struct firmware *fw;
+	int level = -ENOENT;
+
+	if (saved_level)
+		level = saved_level_parse(saved_level, strlen(saved_level));
+
+	if (level < 0 && saved_level_file &&
+	    !request_firmware_direct(&fw, saved_level_file, &wdev->dev)) {
+		level = saved_level_parse(fw->data, fw->size);
+		release_firmware(fw);
+	}
+
+	return level;
+}
+
+static void putdev(void *data)
+{
+	struct device *dev = data;
+
+	put_device(dev);
+}
+
+/* Create the debugfs directory of this device, named after the WMI device. */
+static struct dentry *nvidia_wmi_ec_backlight_debugfs_create(struct wmi_device *wdev)
+{
+	struct dentry *dir;
+	char *name;
+
+	name = kasprintf(GFP_KERNEL, "%s-%s", KBUILD_MODNAME,
+			 dev_name(&wdev->dev));
+	if (!name)
+		return ERR_PTR(-ENOMEM);
+
+	dir = debugfs_create_dir(name, NULL);
+	kfree(name);
+
+	return dir;
+}
+
+static int nvidia_wmi_ec_backlight_probe(struct wmi_device *wdev, const void *ctx)
+{
+	struct backlight_device *bdev, *target = NULL;
+	struct nvidia_wmi_ec_backlight_priv *priv;
+	struct backlight_properties props = {};
+	struct ec_backlight_engine *engine;
+	static int num_reprobe_attempts;
+	static u64 first_probe_ns;
+	u64 probe_start, start;
+	bool saved = false;
+	u32 source;
+	int level, ret;
+
+	probe_start = start = ktime_get_ns();
+	if (!first_probe_ns)
+		first_probe_ns = probe_start;
+
+	priv = devm_kzalloc(&wdev->dev, sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	check_quirks();
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_QUIRKS, &start);
+
+	if (backlight_proxy_target && backlight_proxy_target[0]) {
+		target = backlight_device_get_by_name(backlight_proxy_target);
+
+		if (target) {
+			ret = devm_add_action_or_reset(&wdev->dev, putdev,
+						       &target->dev);
+			if (ret)
+				return ret;
+		} else {
+			/*
+			 * The target backlight device might not be ready;
+			 * try again and disable backlight proxying if it
+			 * fails too many times.
+			 */
+			if (num_reprobe_attempts < max_reprobe_attempts) {
+				num_reprobe_attempts++;
+				timing_phase_end(priv,
+						 NVIDIA_WMI_EC_BACKLIGHT_PHASE_PROXY_LOOKUP,
+						 &start);
+				trace_nvidia_wmi_ec_backlight_probe_defer(
+					num_reprobe_attempts,
+					start - first_probe_ns);
+				return -EPROBE_DEFER;
+			}
+
+			pr_warn("Unable to acquire %s after %d attempts. Disabling backlight proxy.",
+				backlight_proxy_target, max_reprobe_attempts);
+		}
+	}
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_PROXY_LOOKUP, &start);
+
+	ret = wmi_brightness_notify(wdev, WMI_BRIGHTNESS_METHOD_SOURCE,
+	                           WMI_BRIGHTNESS_MODE_GET, &source);
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_SOURCE, &start);
+	if (ret)
+		return ret;
+
+	/*
+	 * This driver is only to be used when brightness control is handled
+	 * by the EC; otherwise, the GPU driver(s) should control brightness.
+	 */
+	if (source != WMI_BRIGHTNESS_SOURCE_EC)
+		return -ENODEV;
+
+	engine = ec_backlight_engine_create(&wdev->dev,
+					    &nvidia_wmi_ec_backlight_engine_ops,
+					    EC_BACKLIGHT_ENGINE_CAP_GET |
+					    EC_BACKLIGHT_ENGINE_CAP_GET_MAX |
+					    EC_BACKLIGHT_ENGINE_CAP_COALESCE,
+					    wdev);
+	if (IS_ERR(engine))
+		return PTR_ERR(engine);
+
+	/*
+	 * Identify this backlight device as a firmware device so that it can
+	 * be prioritized over any exposed GPU-driven raw device(s).
+	 */
+	props.type = BACKLIGHT_FIRMWARE;
+
+	ret = ec_backlight_engine_get_max(engine, &props.max_brightness);
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_MAX_LEVEL, &start);
+	if (ret)
+		return ret;
+
+	/*
+	 * Apply a saved level in place of reading back the EC's, so that the
+	 * panel comes up at it and restoring it from userspace later is elided
+	 * as a write of the level already set.
+	 */
+	level = saved_level_get(wdev);
+	if (level > props.max_brightness) {
+		dev_warn(&wdev->dev, "Ignoring saved level %d above maximum %d\n",
+			 level, props.max_brightness);
+		level = -EINVAL;
+	}
+
+	if (level >= 0) {
+		saved = true;
+		props.brightness = level;
+		ret = ec_backlight_engine_set(engine, level, 0);
+	} else {
+		ret = ec_backlight_engine_get(engine, &props.brightness);
+	}
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_LEVEL, &start);
+	if (ret)
+		return ret;
+
+	ec_backlight_engine_set_shadow(engine, props.brightness);
+
+	priv->wdev = wdev;
+	priv->engine = engine;
+	atomic_set(&priv->relay_level, -1);
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_PROXY))
+		INIT_WORK(&priv->mirror_work, nvidia_wmi_ec_backlight_mirror_work);
+
+	priv->ec_level = props.brightness;
+
+	dev_set_drvdata(&wdev->dev, priv);
+
+	/*
+	 * The character devices and the EC worker are created ahead of the
+	 * backlight device, so that they are torn down only after it. Anything
+	 * which can still issue EC calls is stopped in remove.
+	 */
+	ret = shm_create(wdev, priv);
+	if (ret)
+		return ret;
+
+	ret = anim_create(wdev, priv);
 	if (ret)
 		return ret;
 
+	if (ec_worker) {
+		ret = ec_backlight_engine_start_worker(engine, "nvidia-wmi-ec-bl");
+		if (ret)
+			return ret;
+	}
+
 	bdev = devm_backlight_device_register(&wdev->dev,
 	                                      "nvidia_wmi_ec_backlight",
 					      &wdev->dev, wdev,
@@ -349,28 +2196,78 @@ static int nvidia_wmi_ec_backlight_probe(struct wmi_device *wdev, const void *ct
 	if (IS_ERR(bdev))
 		return PTR_ERR(bdev);
 
-	priv = devm_kzalloc(&wdev->dev, sizeof(*priv), GFP_KERNEL);
-	if (!priv)
-		return -ENOMEM;
+	lockdep_set_class(&bdev->ops_lock, &nvidia_wmi_ec_backlight_ops_lock_key);
 
 	priv->bl_dev = bdev;
-
-	dev_set_drvdata(&wdev->dev, priv);
+	shm_publish(priv);
+
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_STATS) ||
+	    IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM))
+		priv->debugfs = nvidia_wmi_ec_backlight_debugfs_create(wdev);
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_STATS)) {
+		debugfs_create_file("timings", 0444, priv->debugfs, priv,
+				    &nvidia_wmi_ec_backlight_timings_fops);
+		if (ec_backlight_engine_has_worker(engine))
+			debugfs_create_file("ec_worker", 0444, priv->debugfs,
+					    priv, &nvidia_wmi_ec_backlight_ec_worker_fops);
+		if (drift_check)
+			debugfs_create_file("drift", 0444, priv->debugfs, priv,
+					    &nvidia_wmi_ec_backlight_drift_fops);
+	}
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_SIM))
+		wmi_brightness_sim_register(priv);
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_REGISTER, &start);
 
 	if (target) {
-		int level = scale_backlight_level(target, bdev);
+		/*
+		 * A saved level takes precedence over the proxy target's, so relay
+		 * it there instead of importing the target's level; the EC write
+		 * of the level it already has is elided.
+		 */
+		if (saved) {
+			priv->proxy_target = target;
+			if (backlight_update_status(bdev))
+				pr_warn("Unable to apply saved brightness level to %s.",
+					backlight_proxy_target);
+		} else {
+			level = scale_backlight_level(target, bdev);
+			if (backlight_device_set_brightness(bdev, level))
+				pr_warn("Unable to import initial brightness level from %s.",
+					backlight_proxy_target);
+			priv->proxy_target = target;
+		}
 
-		if (backlight_device_set_brightness(bdev, level))
-			pr_warn("Unable to import initial brightness level from %s.",
-				backlight_proxy_target);
-		priv->proxy_target = target;
+		if (bidirectional_proxy) {
+			hook_proxy_target(priv);
+			priv->bl_nb.notifier_call = nvidia_wmi_ec_backlight_bl_notifier;
+			backlight_register_notifier(&priv->bl_nb);
+		}
 	}
-
-	if (restore_level_on_resume) {
-		priv->nb.notifier_call = nvidia_wmi_ec_backlight_pm_notifier;
-		register_pm_notifier(&priv->nb);
+	timing_phase_end(priv, NVIDIA_WMI_EC_BACKLIGHT_PHASE_IMPORT, &start);
+
+	if (thermal_states) {
+		struct thermal_cooling_device *cdev;
+
+		cdev = thermal_cooling_device_register("nvidia-wmi-ec-backlight",
+						       priv,
+						       &nvidia_wmi_ec_backlight_cooling_ops);
+		if (IS_ERR(cdev))
+			dev_warn(&wdev->dev, "Unable to register cooling device: %ld\n",
+				 PTR_ERR(cdev));
+		else
+			priv->cdev = cdev;
 	}
 
+	if (drift_check)
+		drift_start(priv);
+
+	if (hotkeys)
+		hotkey_start(priv);
+
+	priv->timing.probe_ns = ktime_get_ns() - probe_start;
+	priv->timing.defer_count = num_reprobe_attempts;
+	priv->timing.defer_wait_ns = probe_start - first_probe_ns;
+
 	return 0;
 }
 
@@ -378,10 +2275,37 @@ static void nvidia_wmi_ec_backlight_remove(struct wmi_device *wdev)
 {
 	struct nvidia_wmi_ec_backlight_priv *priv = dev_get_drvdata(&wdev->dev);
 
-	if (priv->nb.notifier_call)
-		unregister_pm_notifier(&priv->nb);
+	if (IS_ENABLED(CONFIG_NVIDIA_WMI_EC_BACKLIGHT_PROXY) &&
+	    priv->bl_nb.notifier_call) {
+		backlight_unregister_notifier(&priv->bl_nb);
+		unhook_proxy_target(priv);
+	}
+
+	if (priv->cdev)
+		thermal_cooling_device_unregister(priv->cdev);
+
+	hotkey_stop(priv);
+	drift_stop(priv);
+	anim_stop(priv);
+
+	/*
+	 * Drain the EC worker while what queued calls refer to is still
+	 * around, and switch EC calls back to the caller's context. Every
+	 * engine call after probe holds the ops_lock.
+	 */
+	mutex_lock(&priv->bl_dev->ops_lock);
+	ec_backlight_engine_stop_worker(priv->engine);
+	mutex_unlock(&priv->bl_dev->ops_lock);
+
+	debugfs_remove_recursive(priv->debugfs);
 }
 
+/*
+ * The KUnit test includes this file and calls probe and remove on a fake WMI
+ * device itself, without registering the driver.
+ */
+#ifndef NVIDIA_WMI_EC_BACKLIGHT_KUNIT
+
 #define WMI_BRIGHTNESS_GUID "603E9613-EF25-4338-A3D0-C46177516DB7"
 
 static const struct wmi_device_id nvidia_wmi_ec_backlight_id_table[] = {
@@ -393,6 +2317,8 @@ MODULE_DEVICE_TABLE(wmi, nvidia_wmi_ec_backlight_id_table);
 static struct wmi_driver nvidia_wmi_ec_backlight_driver = {
 	.driver = {
 		.name = "nvidia-wmi-ec-backlight",
+		.dev_groups = nvidia_wmi_ec_backlight_groups,
+		.pm = &nvidia_wmi_ec_backlight_pm_ops,
 	},
 	.probe = nvidia_wmi_ec_backlight_probe,
 	.remove = nvidia_wmi_ec_backlight_remove,
@@ -403,3 +2329,5 @@ module_wmi_driver(nvidia_wmi_ec_backlight_driver);
 MODULE_AUTHOR("Daniel Dadap <ddadap@nvidia.com>");
 MODULE_DESCRIPTION("NVIDIA WMI EC Backlight driver (quirky)");
 MODULE_LICENSE("GPL");
+
+#endif /* NVIDIA_WMI_EC_BACKLIGHT_KUNIT */
@@ -0,0 +1,95 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# A/B benchmark of the driver variants built by "make -C src ab". Loads each
+# variant in turn, runs the same ec-backlight-bench workload against it while
+# the function profiler counts wmidev_evaluate_method() calls, then prints
+# every variant's results next to the first one's with the relative change.
+#
+# usage: ab-bench.sh [-o dir] [-m "module args"] [variant...] [-- bench args]
+#
+# Variants default to "upstream v2 current". Each variant's results are kept
+# in dir (default: ab-results) as "key value" lines. The call count includes
+# any other WMI driver evaluating methods during the run.
+
+set -e
+
+TOOLS=$(dirname "$0")
+AB_DIR=$TOOLS/../src/ab
+MODULE=nvidia-wmi-ec-backlight
+ENGINE=ec-backlight-engine
+BL_DEV=/sys/class/backlight/nvidia_wmi_ec_backlight
+OUT=ab-results
+MODARGS=
+TRACEFS=/sys/kernel/tracing
+[ -d $TRACEFS/trace_stat ] || TRACEFS=/sys/kernel/debug/tracing
+
+while getopts o:m: opt; do
+	case $opt in
+	o) OUT=$OPTARG ;;
+	m) MODARGS=$OPTARG ;;
+	*) sed -n 's/^# usage: /usage: /p' "$0" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+VARIANTS=
+while [ $# -gt 0 ] && [ "$1" != -- ]; do
+	VARIANTS="$VARIANTS $1"
+	shift
+done
+[ "$1" = -- ] && shift
+VARIANTS=${VARIANTS:-upstream v2 current}
+
+unload() {
+	rmmod nvidia_wmi_ec_backlight 2>/dev/null || true
+	rmmod ec_backlight_engine 2>/dev/null || true
+}
+
+# Variants that predate the engine library have no $ENGINE.ko.
+load() {
+	[ ! -e "$1/$ENGINE.ko" ] || insmod "$1/$ENGINE.ko"
+	insmod "$1/$MODULE.ko" $MODARGS
+}
+
+mkdir -p "$OUT"
+trap 'echo 0 > $TRACEFS/function_profile_enabled; echo > $TRACEFS/set_ftrace_filter; unload' EXIT
+echo wmidev_evaluate_method > $TRACEFS/set_ftrace_filter
+
+for v in $VARIANTS; do
+	unload
+	load "$AB_DIR/$v"
+
+	i=0
+	while [ ! -e $BL_DEV ]; do
+		i=$((i + 1))
+		if [ $i -gt 50 ]; then
+			echo "$v: no backlight device after 5s" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+
+	# Re-enabling the profiler resets its counters.
+	echo 0 > $TRACEFS/function_profile_enabled
+	echo 1 > $TRACEFS/function_profile_enabled
+	"$TOOLS/ec-backlight-bench" "$@" > "$OUT/$v"
+	echo 0 > $TRACEFS/function_profile_enabled
+
+	cat $TRACEFS/trace_stat/function* | awk '
+		$1 == "wmidev_evaluate_method" { hits += $2; us += $3 }
+		END { printf "wmi_calls %d\nwmi_time_us %.3f\n", hits, us }' >> "$OUT/$v"
+done
+
+set -- $VARIANTS
+BASE=$1
+shift
+
+for v in "$@"; do
+	echo "# $BASE -> $v"
+	awk 'NR == FNR { base[$1] = $2; next }
+	     ($1 in base) && $2 ~ /^[0-9.]+$/ {
+		d = base[$1] ? sprintf("%+.1f%%", ($2 - base[$1]) * 100 / base[$1]) : "-"
+		printf "%-24s %14s %14s %10s\n", $1, base[$1], $2, d
+	     }' "$OUT/$BASE" "$OUT/$v"
+done
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Helpers shared by the backlight sysfs tools.
+ */
+
+#ifndef BL_SYSFS_H
+#define BL_SYSFS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BL_DEFAULT_DEVICE "nvidia_wmi_ec_backlight"
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void sleep_until(unsigned long long ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* Open an attribute of the backlight device in sysfs directory dir. */
+static inline int bl_open(const char *dir, const char *attr, int flags)
+{
+	char path[512];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, flags);
+	if (fd < 0)
+		perror(path);
+
+	return fd;
+}
+
+static inline int bl_read_level(int fd)
+{
+	char buf[16];
+	ssize_t len;
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	return atoi(buf);
+}
+
+static inline int bl_write_level(int fd, int level)
+{
+	char buf[16];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%d\n", level);
+
+	return pwrite(fd, buf, len, 0) == len ? 0 : -1;
+}
+
+#endif /* BL_SYSFS_H */
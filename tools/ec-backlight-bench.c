@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Brightness load generator and latency benchmark for backlight class
+ * devices. Drives one of several workload profiles against the sysfs
+ * interface and reports latency percentiles and throughput of reads
+ * (actual_brightness) and writes (brightness), as text or JSON.
+ *
+ * Works against any backlight device, e.g. a dummy one, or a plain
+ * directory holding brightness, actual_brightness and max_brightness files.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bl-sysfs.h"
+
+enum profile {
+	PROFILE_DRAG,	/* slider drag: bursts of back-to-back writes */
+	PROFILE_FADE,	/* steady fade: writes at a fixed rate */
+	PROFILE_POLL,	/* read-heavy polling */
+	PROFILE_MIXED,	/* concurrent readers and writers */
+};
+
+static const char * const profile_names[] = {
+	[PROFILE_DRAG] = "drag",
+	[PROFILE_FADE] = "fade",
+	[PROFILE_POLL] = "poll",
+	[PROFILE_MIXED] = "mixed",
+};
+
+struct samples {
+	unsigned long long *ns;
+	size_t n, cap;
+	size_t errors;
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	bool writer;
+	struct samples reads, writes;
+};
+
+static const char *dir;
+static enum profile profile = PROFILE_DRAG;
+static int max_level;
+static unsigned int rate_hz;
+static unsigned int burst_len = 32;
+static unsigned int burst_gap_ms = 250;
+static unsigned long long deadline;
+
+static void samples_add(struct samples *s, unsigned long long ns)
+{
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 4096;
+		s->ns = realloc(s->ns, s->cap * sizeof(*s->ns));
+		if (!s->ns) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->ns[s->n++] = ns;
+}
+
+static void samples_merge(struct samples *dst, const struct samples *src)
+{
+	size_t i;
+
+	for (i = 0; i < src->n; i++)
+		samples_add(dst, src->ns[i]);
+	dst->errors += src->errors;
+}
+
+static void timed_write(struct worker *w, int fd, int level)
+{
+	unsigned long long t = now_ns();
+
+	if (bl_write_level(fd, level))
+		w->writes.errors++;
+	else
+		samples_add(&w->writes, now_ns() - t);
+}
+
+static void timed_read(struct worker *w, int fd)
+{
+	unsigned long long t = now_ns();
+
+	if (bl_read_level(fd) < 0)
+		w->reads.errors++;
+	else
+		samples_add(&w->reads, now_ns() - t);
+}
+
+/* Sweep levels up and down across the whole range. */
+static int next_level(int level, int *dir_step)
+{
+	int step = max_level / 64 ? max_level / 64 : 1;
+
+	level += *dir_step * step;
+	if (level >= max_level || level <= 0) {
+		*dir_step = -*dir_step;
+		level = level < 0 ? 0 : level > max_level ? max_level : level;
+	}
+
+	return level;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long period = rate_hz ? 1000000000ULL / rate_hz : 0;
+	unsigned long long next = now_ns();
+	int wfd = -1, rfd = -1, level = max_level / 2, dir_step = 1;
+	unsigned int seed = w->id + 1, i;
+
+	if (w->writer)
+		wfd = bl_open(dir, "brightness", O_WRONLY);
+	else
+		rfd = bl_open(dir, "actual_brightness", O_RDONLY);
+	if (wfd < 0 && rfd < 0)
+		return NULL;
+
+	while (now_ns() < deadline) {
+		switch (profile) {
+		case PROFILE_DRAG:
+			for (i = 0; i < burst_len; i++) {
+				level = next_level(level, &dir_step);
+				timed_write(w, wfd, level);
+			}
+			next = now_ns() + burst_gap_ms * 1000000ULL;
+			break;
+		case PROFILE_FADE:
+			level = next_level(level, &dir_step);
+			timed_write(w, wfd, level);
+			next += period;
+			break;
+		case PROFILE_POLL:
+			timed_read(w, rfd);
+			next += period;
+			break;
+		case PROFILE_MIXED:
+			if (w->writer)
+				timed_write(w, wfd, rand_r(&seed) % (max_level + 1));
+			else
+				timed_read(w, rfd);
+			next += period;
+			break;
+		}
+
+		if (profile == PROFILE_DRAG || period)
+			sleep_until(next);
+	}
+
+	if (wfd >= 0)
+		close(wfd);
+	if (rfd >= 0)
+		close(rfd);
+
+	return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned long long percentile(const struct samples *s, double p)
+{
+	size_t i;
+
+	if (!s->n)
+		return 0;
+
+	i = (size_t)(p / 100.0 * (s->n - 1) + 0.5);
+	return s->ns[i];
+}
+
+static void report(const char *name, struct samples *s, double secs, bool json,
+		   bool last)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9 };
+	static const char * const pct_names[] = { "p50", "p90", "p99", "p999" };
+	size_t i;
+
+	qsort(s->ns, s->n, sizeof(*s->ns), cmp_ull);
+
+	if (json) {
+		printf("  \"%s\": {\"ops\": %zu, \"errors\": %zu, \"ops_per_sec\": %.1f",
+		       name, s->n, s->errors, s->n / secs);
+		for (i = 0; i < 4; i++)
+			printf(", \"%s_ns\": %llu", pct_names[i],
+			       percentile(s, pcts[i]));
+		printf(", \"max_ns\": %llu}%s\n", s->n ? s->ns[s->n - 1] : 0,
+		       last ? "" : ",");
+		return;
+	}
+
+	printf("%s_ops %zu\n", name, s->n);
+	printf("%s_errors %zu\n", name, s->errors);
+	printf("%s_ops_per_sec %.1f\n", name, s->n / secs);
+	for (i = 0; i < 4; i++)
+		printf("%s_%s_ns %llu\n", name, pct_names[i], percentile(s, pcts[i]));
+	printf("%s_max_ns %llu\n", name, s->n ? s->ns[s->n - 1] : 0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"\n"
+		"  -d device   backlight device name (default: " BL_DEFAULT_DEVICE ")\n"
+		"  -s dir      backlight sysfs directory, overrides -d\n"
+		"  -p profile  drag, fade, poll or mixed (default: drag)\n"
+		"  -t threads  number of threads; mixed splits them between\n"
+		"              readers and writers (default: 1, mixed: 4)\n"
+		"  -D seconds  duration (default: 5)\n"
+		"  -r hz       per-thread request rate, 0 for unthrottled\n"
+		"              (default: 60 for fade, 0 otherwise)\n"
+		"  -b n        writes per drag burst (default: 32)\n"
+		"  -g ms       gap between drag bursts (default: 250)\n"
+		"  -j          print JSON instead of plain text\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = BL_DEFAULT_DEVICE;
+	struct samples reads = {}, writes = {};
+	unsigned int duration = 5, i;
+	int opt, nthreads = 0, fd;
+	unsigned long long start;
+	bool json = false, rate_set = false;
+	struct worker *workers;
+	char default_dir[256];
+	double secs;
+
+	while ((opt = getopt(argc, argv, "d:s:p:t:D:r:b:g:j")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 's':
+			dir = optarg;
+			break;
+		case 'p':
+			for (i = 0; i < 4; i++)
+				if (!strcmp(optarg, profile_names[i]))
+					break;
+			if (i == 4)
+				usage(argv[0]);
+			profile = i;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'D':
+			duration = atoi(optarg);
+			break;
+		case 'r':
+			rate_hz = atoi(optarg);
+			rate_set = true;
+			break;
+		case 'b':
+			burst_len = atoi(optarg);
+			break;
+		case 'g':
+			burst_gap_ms = atoi(optarg);
+			break;
+		case 'j':
+			json = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!dir) {
+		snprintf(default_dir, sizeof(default_dir),
+			 "/sys/class/backlight/%s", device);
+		dir = default_dir;
+	}
+
+	if (nthreads <= 0)
+		nthreads = profile == PROFILE_MIXED ? 4 : 1;
+	if (!rate_set && profile == PROFILE_FADE)
+		rate_hz = 60;
+
+	fd = bl_open(dir, "max_brightness", O_RDONLY);
+	if (fd < 0)
+		return 1;
+	max_level = bl_read_level(fd);
+	close(fd);
+	if (max_level <= 0) {
+		fprintf(stderr, "%s: invalid max_brightness\n", dir);
+		return 1;
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now_ns();
+	deadline = start + duration * 1000000000ULL;
+	for (i = 0; i < (unsigned int)nthreads; i++) {
+		workers[i].id = i;
+		if (profile == PROFILE_MIXED)
+			workers[i].writer = i % 2;
+		else
+			workers[i].writer = profile != PROFILE_POLL;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < (unsigned int)nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		samples_merge(&reads, &workers[i].reads);
+		samples_merge(&writes, &workers[i].writes);
+	}
+	secs = (now_ns() - start) / 1e9;
+
+	if (json) {
+		printf("{\n  \"device\": \"%s\",\n  \"profile\": \"%s\",\n"
+		       "  \"threads\": %d,\n  \"seconds\": %.3f,\n",
+		       dir, profile_names[profile], nthreads, secs);
+		report("read", &reads, secs, true, false);
+		report("write", &writes, secs, true, true);
+		printf("}\n");
+	} else {
+		printf("device %s\nprofile %s\nthreads %d\nseconds %.3f\n",
+		       dir, profile_names[profile], nthreads, secs);
+		report("read", &reads, secs, false, false);
+		report("write", &writes, secs, false, true);
+	}
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Capture the brightness requests handled by nvidia-wmi-ec-backlight into a
+# private tracefs instance, for later replay with ec-backlight-replay.
+#
+# usage: ec-backlight-capture.sh <output> [seconds]
+#
+# Without a duration, capture runs until interrupted.
+
+set -e
+
+OUT=${1:?usage: $0 <output> [seconds]}
+SECS=$2
+TRACEFS=/sys/kernel/tracing
+[ -d $TRACEFS/instances ] || TRACEFS=/sys/kernel/debug/tracing
+INST=$TRACEFS/instances/nvidia_wmi_ec_backlight
+
+mkdir -p $INST
+trap 'echo 0 > $INST/tracing_on; cat $INST/trace > "$OUT"; rmdir $INST' EXIT
+trap 'exit 0' INT TERM
+
+echo 4096 > $INST/buffer_size_kb
+echo 1 > $INST/events/nvidia_wmi_ec_backlight/enable
+echo 1 > $INST/tracing_on
+
+if [ -n "$SECS" ]; then
+	sleep "$SECS"
+else
+	echo "capturing to $OUT, press ^C to stop" >&2
+	while :; do sleep 3600; done
+fi
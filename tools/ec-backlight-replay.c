@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Replay brightness requests captured by ec-backlight-capture.sh against a
+ * backlight class device, reproducing the original timing, and report the
+ * latency of each request. Two replay results can be compared with -c.
+ */
+
+#include <string.h>
+
+#include "bl-sysfs.h"
+
+#define EVENT "nvidia_wmi_ec_backlight_request:"
+
+struct request {
+	unsigned long long ts_ns;
+	char source[16];
+	int level;
+	unsigned long long latency_ns;
+};
+
+/*
+ * Parse one line of tracefs output, e.g.:
+ *   bash-1234 [002] ..... 1234.567890: nvidia_wmi_ec_backlight_request: source=update level=42
+ */
+static int parse_trace_line(const char *line, struct request *req)
+{
+	const char *ev = strstr(line, EVENT);
+	const char *p;
+	unsigned long sec, usec;
+
+	if (!ev)
+		return -1;
+
+	/* the timestamp is the last token before the event name */
+	for (p = ev - 2; p > line && p[-1] != ' '; p--)
+		;
+	if (sscanf(p, "%lu.%lu:", &sec, &usec) != 2)
+		return -1;
+
+	if (sscanf(ev + strlen(EVENT), " source=%15s level=%d",
+		   req->source, &req->level) != 2)
+		return -1;
+
+	req->ts_ns = sec * 1000000000ULL + usec * 1000ULL;
+	req->latency_ns = 0;
+
+	return 0;
+}
+
+static struct request *read_trace(FILE *f, size_t *count)
+{
+	struct request *reqs = NULL, req;
+	size_t n = 0, cap = 0;
+	char line[512];
+
+	while (fgets(line, sizeof(line), f)) {
+		if (parse_trace_line(line, &req))
+			continue;
+		if (n == cap) {
+			cap = cap ? cap * 2 : 256;
+			reqs = realloc(reqs, cap * sizeof(*reqs));
+			if (!reqs) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		reqs[n++] = req;
+	}
+
+	*count = n;
+	return reqs;
+}
+
+/* Whether source is one of the comma separated names in sources. */
+static int source_selected(const char *sources, const char *source)
+{
+	size_t len = strlen(source);
+	const char *p = sources;
+
+	while (*p) {
+		size_t n = strcspn(p, ",");
+
+		if (n == len && !strncmp(p, source, len))
+			return 1;
+		p += n;
+		if (*p)
+			p++;
+	}
+
+	return 0;
+}
+
+static int replay(struct request *reqs, size_t n, const char *dir,
+		  double speed, const char *sources)
+{
+	unsigned long long start, t0 = n ? reqs[0].ts_ns : 0;
+	size_t i;
+	int fd;
+
+	fd = bl_open(dir, "brightness", O_WRONLY);
+	if (fd < 0)
+		return -1;
+
+	printf("# seq offset_us source level latency_ns\n");
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		struct request *r = &reqs[i];
+		unsigned long long t;
+
+		if (!source_selected(sources, r->source))
+			continue;
+
+		sleep_until(start + (r->ts_ns - t0) / speed);
+
+		t = now_ns();
+		if (bl_write_level(fd, r->level))
+			fprintf(stderr, "write of %d failed: %s\n", r->level,
+				strerror(errno));
+		r->latency_ns = now_ns() - t;
+
+		printf("%zu %llu %s %d %llu\n", i, (r->ts_ns - t0) / 1000,
+		       r->source, r->level, r->latency_ns);
+	}
+
+	close(fd);
+	return 0;
+}
+
+static struct request *read_result(const char *path, size_t *count)
+{
+	struct request *reqs = NULL, req;
+	size_t n = 0, cap = 0, seq;
+	unsigned long long offset_us;
+	char line[256];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%zu %llu %15s %d %llu", &seq, &offset_us,
+			   req.source, &req.level, &req.latency_ns) != 5)
+			continue;
+		req.ts_ns = offset_us * 1000;
+		if (n == cap) {
+			cap = cap ? cap * 2 : 256;
+			reqs = realloc(reqs, cap * sizeof(*reqs));
+			if (!reqs) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		reqs[n++] = req;
+	}
+
+	fclose(f);
+	*count = n;
+	return reqs;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int compare(const char *base_path, const char *new_path)
+{
+	struct request *base, *new;
+	size_t nb, nn, n, i;
+	long long *deltas, sum = 0;
+
+	base = read_result(base_path, &nb);
+	new = read_result(new_path, &nn);
+	n = nb < nn ? nb : nn;
+	if (nb != nn)
+		fprintf(stderr, "warning: %zu vs %zu requests, comparing the first %zu\n",
+			nb, nn, n);
+	if (!n)
+		return -1;
+
+	deltas = calloc(n, sizeof(*deltas));
+	if (!deltas) {
+		perror("calloc");
+		return -1;
+	}
+
+	printf("# seq level base_ns new_ns delta_ns\n");
+	for (i = 0; i < n; i++) {
+		deltas[i] = (long long)new[i].latency_ns - (long long)base[i].latency_ns;
+		sum += deltas[i];
+		printf("%zu %d %llu %llu %lld\n", i, new[i].level,
+		       base[i].latency_ns, new[i].latency_ns, deltas[i]);
+	}
+
+	qsort(deltas, n, sizeof(*deltas), cmp_ll);
+	printf("# requests %zu\n", n);
+	printf("# delta_mean_ns %lld\n", sum / (long long)n);
+	printf("# delta_p50_ns %lld\n", deltas[n / 2]);
+	printf("# delta_p99_ns %lld\n", deltas[(n * 99) / 100]);
+
+	free(deltas);
+	free(base);
+	free(new);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d device | -s sysfs-dir] [-x speed] [-S sources] <trace>\n"
+		"       %s -c <base-result> <new-result>\n"
+		"\n"
+		"  -d device   backlight device name (default: nvidia_wmi_ec_backlight)\n"
+		"  -s dir      backlight sysfs directory, overrides -d\n"
+		"  -x speed    replay speed factor (default: 1.0)\n"
+		"  -S sources  comma separated request sources to replay as writes\n"
+		"              (default: update, i.e. sysfs writes; the others are\n"
+		"              hotkey, resume, mirror, thermal and drift)\n"
+		"  -c          compare two replay results instead of replaying\n",
+		prog, prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = BL_DEFAULT_DEVICE, *dir = NULL, *sources = "update";
+	int opt, do_compare = 0;
+	char default_dir[256];
+	struct request *reqs;
+	double speed = 1.0;
+	size_t n;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "d:s:x:S:c")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 's':
+			dir = optarg;
+			break;
+		case 'x':
+			speed = strtod(optarg, NULL);
+			if (speed <= 0)
+				usage(argv[0]);
+			break;
+		case 'S':
+			sources = optarg;
+			break;
+		case 'c':
+			do_compare = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (do_compare) {
+		if (argc - optind != 2)
+			usage(argv[0]);
+		return compare(argv[optind], argv[optind + 1]) ? 1 : 0;
+	}
+
+	if (argc - optind != 1)
+		usage(argv[0]);
+
+	if (!dir) {
+		snprintf(default_dir, sizeof(default_dir),
+			 "/sys/class/backlight/%s", device);
+		dir = default_dir;
+	}
+
+	f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	reqs = read_trace(f, &n);
+	if (f != stdin)
+		fclose(f);
+
+	if (!n) {
+		fprintf(stderr, "no requests found in %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (replay(reqs, n, dir, speed, sources))
+		return 1;
+
+	free(reqs);
+	return 0;
+}
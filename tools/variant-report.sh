@@ -0,0 +1,67 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Report the size and load time of the feature variants built by
+# "make -C src variants". Sizes are those of the driver and the engine
+# module it needs together. Load time runs from insmod of the engine until
+# that of the driver returns, which includes probing, and is the median of
+# several loads.
+#
+# usage: variant-report.sh [-n loads] [-m "module args"] [variant...]
+#
+# Without variant names, every variant that has been built is reported.
+
+set -e
+
+VAR_DIR=$(dirname "$0")/../src/variants
+MODULE=nvidia-wmi-ec-backlight
+ENGINE=ec-backlight-engine
+LOADS=5
+MODARGS=
+
+while getopts n:m: opt; do
+	case $opt in
+	n) LOADS=$OPTARG ;;
+	m) MODARGS=$OPTARG ;;
+	*) sed -n 's/^# usage: /usage: /p' "$0" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+[ $# -gt 0 ] || set -- $(ls "$VAR_DIR")
+
+unload() {
+	rmmod nvidia_wmi_ec_backlight 2>/dev/null || true
+	rmmod ec_backlight_engine 2>/dev/null || true
+}
+
+# Variants that predate the engine library have no $ENGINE.ko.
+load() {
+	[ ! -e "$1/$ENGINE.ko" ] || insmod "$1/$ENGINE.ko"
+	insmod "$1/$MODULE.ko" $MODARGS
+}
+
+trap unload EXIT
+
+printf '%-20s %8s %8s %8s %10s\n' variant text data bss load_us
+for v; do
+	kos=$VAR_DIR/$v/$MODULE.ko
+	[ ! -e "$VAR_DIR/$v/$ENGINE.ko" ] || kos="$kos $VAR_DIR/$v/$ENGINE.ko"
+	sizes=$(size $kos | awk 'NR > 1 { t += $1; d += $2; b += $3 }
+				  END { print t, d, b }')
+
+	times=
+	i=0
+	while [ $i -lt "$LOADS" ]; do
+		unload
+		t0=$(date +%s%N)
+		load "$VAR_DIR/$v"
+		t1=$(date +%s%N)
+		times="$times $(((t1 - t0) / 1000))"
+		i=$((i + 1))
+	done
+
+	median=$(echo $times | tr ' ' '\n' | sort -n |
+		 awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }')
+	printf '%-20s %8s %8s %8s %10s\n' "$v" $sizes "$median"
+done